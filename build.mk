@@ -7,6 +7,13 @@ TYPE = native
 COMMIT_HASH = off
 DISABLE_NEON_DOTPROD = off
 USE_LIBNUMA = off
+SHARED_NETWORK = off
+
+# counts how often each threat feature is used, for bench to write out as threat_features.txt
+THREAT_FEATURE_PROFILE = off
+
+# per-feature counts from a build with THREAT_FEATURE_PROFILE=on, to order threat weight rows by
+THREAT_FEATURE_COUNTS =
 
 # https://stackoverflow.com/a/1825832
 rwildcard = $(foreach d,$(wildcard $(1:=/*)),$(call rwildcard,$d,$2) $(filter $(subst *,%,$2),$d))
@@ -96,6 +103,14 @@ ifeq ($(USE_LIBNUMA),on)
 	LDFLAGS += -lnuma
 endif
 
+ifeq ($(SHARED_NETWORK),on)
+	FLAGS += -DSP_SHARED_NETWORK
+endif
+
+ifeq ($(THREAT_FEATURE_PROFILE),on)
+	FLAGS += -DSP_THREAT_FEATURE_PROFILE=1
+endif
+
 OUTFILE = $(subst .exe,,$(EXE))$(SUFFIX)
 
 ifeq ($(TYPE), native)
@@ -152,8 +167,8 @@ EVALFILE_NAME := $(notdir $(EVALFILE))
 tmp/permute-$(TYPE): tmp $(SOURCES_PERMUTE)
 	$(CXX) $(CXXFLAGS_PERMUTE) $(LDFLAGS) -o tmp/permute-$(TYPE) $(filter-out $<,$^)
 
-tmp/$(EVALFILE_NAME)_permuted_$(TYPE): $(EVALFILE) tmp/permute-$(TYPE)
-	tmp/permute-$(TYPE) $< $@
+tmp/$(EVALFILE_NAME)_permuted_$(TYPE): $(EVALFILE) tmp/permute-$(TYPE) $(THREAT_FEATURE_COUNTS)
+	tmp/permute-$(TYPE) $< $@ $(THREAT_FEATURE_COUNTS)
 
 $(BUILD_DIR)/%.o: %.c version.txt tmp/$(EVALFILE_NAME)_permuted_$(TYPE) | $$(@D)/
 	$(CC) $(CFLAGS_ENGINE) -DSP_NETWORK_FILE=\"tmp/$(EVALFILE_NAME)_permuted_$(TYPE)\" -c -o $@ $<
@@ -18,10 +18,15 @@
 
 #include "../src/types.h"
 
+#include <algorithm>
+#include <cstring>
 #include <fstream>
 #include <iterator>
 #include <memory>
+#include <numeric>
+#include <optional>
 #include <type_traits>
+#include <vector>
 
 #include "../src/eval/arch.h"
 #include "../src/eval/header.h"
@@ -55,12 +60,89 @@ struct LoadedNetwork {
     std::array<i32, OutputBucketing::kBucketCount> l3Biases;
 };
 
+// Reads the per-feature counts written by a build with THREAT_FEATURE_PROFILE=on
+std::optional<std::vector<usize>> readThreatFeatureCounts(const char* path) {
+    std::ifstream in{path};
+    if (!in) {
+        eprintln("Failed to open threat feature counts \"{}\"", path);
+        return {};
+    }
+
+    std::vector<usize> counts{};
+
+    usize count;
+    while (in >> count) {
+        counts.push_back(count);
+
+        char separator;
+        if (!(in >> separator)) {
+            break;
+        }
+
+        if (separator != ',') {
+            eprintln("Invalid threat feature counts");
+            return {};
+        }
+    }
+
+    if (counts.size() != InputFeatureSet::kThreatFeatures) {
+        eprintln(
+            "Wrong number of threat feature counts {} (expected: {})",
+            counts.size(),
+            InputFeatureSet::kThreatFeatures
+        );
+        return {};
+    }
+
+    return counts;
+}
+
+// Stores threat weight rows from most to least used, returning the row each feature ended up in
+std::vector<u16> reorderThreatRows(std::span<i8> weights, std::span<const usize> counts) {
+    // features in their new row order
+    std::vector<u32> features(counts.size());
+    std::iota(features.begin(), features.end(), 0);
+    std::ranges::stable_sort(features, [&](u32 a, u32 b) { return counts[a] > counts[b]; });
+
+    const std::vector<i8> original(weights.begin(), weights.end());
+
+    std::vector<u16> order(counts.size());
+
+    for (usize row = 0; row < features.size(); ++row) {
+        const auto feature = features[row];
+        std::memcpy(&weights[row * kL1Size], &original[feature * kL1Size], kL1Size);
+        order[feature] = static_cast<u16>(row);
+    }
+
+    const auto total = std::accumulate(counts.begin(), counts.end(), usize{0});
+    const auto hot = std::accumulate(
+        features.begin(),
+        features.begin() + features.size() / 10,
+        usize{0},
+        [&](usize sum, u32 feature) { return sum + counts[feature]; }
+    );
+
+    println(
+        "{:.1f}% of threat feature uses are now in the first 10% of rows",
+        total == 0 ? 0.0 : static_cast<f64>(hot) * 100.0 / static_cast<f64>(total)
+    );
+
+    return order;
+}
+
 i32 main(i32 argc, char* argv[]) {
     if (argc < 3) {
-        eprintln("usage: {} <input net> <output net>", argv[0]);
+        eprintln("usage: {} <input net> <output net> [threat feature counts]", argv[0]);
         return 1;
     }
 
+    const char* countsPath = argc > 3 ? argv[3] : nullptr;
+
+    if (countsPath && !InputFeatureSet::kThreatInputs) {
+        println("No threat inputs in current network arch, ignoring threat feature counts");
+        countsPath = nullptr;
+    }
+
     std::ifstream in{argv[1], std::ios::binary};
     if (!in) {
         eprintln("Failed to open input file \"{}\"", argv[1]);
@@ -91,6 +173,9 @@ i32 main(i32 argc, char* argv[]) {
 
     if (testFlags(header.flags, NetworkFlags::kZstdCompressed)) {
         println("Compressed network, skipping permutation");
+        if (countsPath) {
+            println("Threat weight rows cannot be reordered in compressed networks");
+        }
         std::copy(std::istreambuf_iterator{in}, std::istreambuf_iterator<char>{}, std::ostreambuf_iterator{out});
         if (!out) {
             eprintln("Failed to write network");
@@ -99,7 +184,7 @@ i32 main(i32 argc, char* argv[]) {
         return 0;
     }
 
-    if constexpr (!LayeredArch::kRequiresFtPermute) {
+    if (!LayeredArch::kRequiresFtPermute && !countsPath) {
         println("No permutation required for current network arch");
         std::copy(std::istreambuf_iterator{in}, std::istreambuf_iterator<char>{}, std::ostreambuf_iterator{out});
         if (!out) {
@@ -116,13 +201,29 @@ i32 main(i32 argc, char* argv[]) {
         return 1;
     }
 
-    println("Permuting network");
+    if constexpr (LayeredArch::kRequiresFtPermute) {
+        println("Permuting network");
 
-    LayeredArch::permuteParams<i16>(network->ftWeights.psq);
-    LayeredArch::permuteParams<i16>(network->ftBiases);
+        LayeredArch::permuteParams<i16>(network->ftWeights.psq);
+        LayeredArch::permuteParams<i16>(network->ftBiases);
+
+        if constexpr (InputFeatureSet::kThreatInputs) {
+            LayeredArch::permuteParams<i8>(network->ftWeights.threat);
+        }
+    }
+
+    std::vector<u16> threatRowOrder{};
 
     if constexpr (InputFeatureSet::kThreatInputs) {
-        LayeredArch::permuteParams<i8>(network->ftWeights.threat);
+        if (countsPath) {
+            const auto counts = readThreatFeatureCounts(countsPath);
+            if (!counts) {
+                return 1;
+            }
+
+            println("Reordering threat weight rows");
+            threatRowOrder = reorderThreatRows(network->ftWeights.threat, *counts);
+        }
     }
 
     if (!out.write(reinterpret_cast<const char*>(network.get()), sizeof(LoadedNetwork))) {
@@ -130,5 +231,22 @@ i32 main(i32 argc, char* argv[]) {
         return 1;
     }
 
+    if (!threatRowOrder.empty()) {
+        const ThreatRowOrderHeader orderHeader{
+            .magic = kThreatRowOrderMagic,
+            .rowCount = static_cast<u32>(threatRowOrder.size()),
+        };
+
+        if (!out.write(reinterpret_cast<const char*>(&orderHeader), sizeof(orderHeader))
+            || !out.write(
+                reinterpret_cast<const char*>(threatRowOrder.data()),
+                static_cast<std::streamsize>(threatRowOrder.size() * sizeof(u16))
+            ))
+        {
+            eprintln("Failed to write threat row order");
+            return 1;
+        }
+    }
+
     return 0;
 }
@@ -18,8 +18,14 @@
 
 #include "bench.h"
 
+#include <algorithm>
 #include <array>
+#include <chrono>
+#include <cmath>
+#include <numeric>
 #include <string_view>
+#include <thread>
+#include <vector>
 
 #if SP_SPARSE_BENCH_L1_SIZE > 0
     #include <fmt/ostream.h>
@@ -92,7 +98,77 @@ namespace stormphrax::bench {
         "nqbnrkrb/pppppppp/8/8/8/8/PPPPPPPP/NQBNRKRB w GEge - 0 1"sv,
     };
 
-    void run(i32 depth, usize ttSize) {
+    namespace {
+        search::BenchData runPositions(search::Searcher& searcher, search::ThreadData& thread, bool verbose) {
+            search::BenchData total{};
+
+            const auto benchPosition = [&](std::string_view fen) {
+                if (verbose) {
+                    println("fen: {}", fen);
+                }
+
+                thread.rootPos = *Position::fromFen(fen);
+
+                search::BenchData data{};
+                searcher.runBenchSearch(data);
+
+                total.time += data.time;
+                total.nodes += data.nodes;
+
+                if (verbose) {
+                    println();
+                }
+            };
+
+            opts::mutableOpts().chess960 = false;
+
+            for (const auto fen : kStandardFens) {
+                benchPosition(fen);
+            }
+
+            opts::mutableOpts().chess960 = true;
+
+            for (const auto fen : kFrcFens) {
+                benchPosition(fen);
+            }
+
+            return total;
+        }
+
+        // Runs the positions once per mode, each on a fresh searcher that setMode(mode, searcher)
+        // has switched to it, and passes the results to report(mode, searcher, thread, time, nodes)
+        template <typename Mode, typename SetMode, typename Report>
+        void runModes(i32 depth, usize ttSize, std::span<const Mode> modes, SetMode setMode, Report report) {
+            const auto prevMinimal = g_opts.minimal;
+            const auto prevChess960 = g_opts.chess960;
+
+            numa::bindThread(0);
+
+            opts::mutableOpts().minimal = true;
+
+            for (const auto mode : modes) {
+                search::Searcher searcher{ttSize};
+
+                searcher.setLimiter(limit::SearchLimiter{util::Instant::now()});
+                searcher.setMaxDepth(depth);
+                searcher.setSilent(true);
+
+                setMode(mode, searcher);
+
+                auto& thread = searcher.take();
+
+                searcher.newGame();
+
+                const auto [time, nodes] = runPositions(searcher, thread, false);
+                report(mode, searcher, thread, time, nodes);
+            }
+
+            opts::mutableOpts().minimal = prevMinimal;
+            opts::mutableOpts().chess960 = prevChess960;
+        }
+    } // namespace
+
+    void run(i32 depth, usize ttSize, bool verbose) {
         if (!eval::isNetworkLoaded()) {
             eprintln("No network loaded");
             return;
@@ -114,42 +190,37 @@ namespace stormphrax::bench {
 
         searcher.newGame();
 
-        f64 time{};
-        usize nodes{};
+        const auto [time, nodes] = runPositions(searcher, thread, true);
 
-        const auto benchPosition = [&](std::string_view fen) {
-            println("fen: {}", fen);
-
-            thread.rootPos = *Position::fromFen(fen);
-
-            search::BenchData data{};
-            searcher.runBenchSearch(data);
-
-            time += data.time;
-            nodes += data.nodes;
+        opts::mutableOpts().minimal = prevMinimal;
+        opts::mutableOpts().chess960 = prevChess960;
 
-            println();
-        };
+        println("{:.3f} seconds", time);
+        println("{} nodes {} nps", nodes, static_cast<usize>(static_cast<f64>(nodes) / time));
 
-        opts::mutableOpts().chess960 = false;
+        stats::print();
 
-        for (const auto fen : kStandardFens) {
-            benchPosition(fen);
+        if (const auto ttStats = searcher.ttStats()) {
+            ttStats->print();
         }
 
-        opts::mutableOpts().chess960 = true;
-
-        for (const auto fen : kFrcFens) {
-            benchPosition(fen);
+        if (verbose) {
+            println("network backed by {}", util::pageBackingName(eval::networkPageBacking()));
         }
 
-        opts::mutableOpts().minimal = prevMinimal;
-        opts::mutableOpts().chess960 = prevChess960;
-
-        println("{:.3f} seconds", time);
-        println("{} nodes {} nps", nodes, static_cast<usize>(static_cast<f64>(nodes) / time));
+        if (verbose && g_opts.evalCache) {
+            const auto [probes, hits] = thread.nnueState.evalCacheStats();
+            println(
+                "eval cache: {} hits of {} probes ({:.2f}%)",
+                hits,
+                probes,
+                probes == 0 ? 0.0 : static_cast<f64>(hits) * 100.0 / static_cast<f64>(probes)
+            );
+        }
 
-        stats::print();
+        if (verbose) {
+            thread.nnueState.updateStats().print();
+        }
 
 #if SP_SPARSE_BENCH_L1_SIZE > 0
         std::ofstream stream{"activations.txt", std::ios::binary};
@@ -167,5 +238,479 @@ namespace stormphrax::bench {
 
         println("Wrote FT activation counts to activations.txt");
 #endif
+
+#if SP_THREAT_FEATURE_PROFILE
+        namespace threats = eval::nnue::features::threats;
+
+        // counted by row, so they need the order of the network they were gathered with
+        const auto* rowOrder = eval::getNetwork(0)->featureTransformer().threatRowOrder;
+
+        if (threats::writeFeatureCounts(
+                "threat_features.txt",
+                rowOrder ? std::span{rowOrder, threats::kTotalThreatFeatures} : std::span<const u16>{}
+            ))
+        {
+            println("Wrote threat feature counts to threat_features.txt");
+        }
+#endif
+    }
+
+    void runTt(i32 depth, usize ttSize) {
+        if (!eval::isNetworkLoaded()) {
+            eprintln("No network loaded");
+            return;
+        }
+
+        println("depth {}, {} MiB", depth, ttSize);
+
+        runModes<TtLayout>(
+            depth,
+            ttSize,
+            kTtLayouts,
+            [](TtLayout layout, search::Searcher& searcher) {
+                searcher.setTtLayout(layout);
+                searcher.setTtCollisionTracking(true);
+            },
+            [](TtLayout layout, const search::Searcher& searcher, const search::ThreadData&, f64 time, usize nodes) {
+                const auto [hits, collisions] = searcher.ttable().collisionStats();
+
+                const auto collisionRate =
+                    hits == 0 ? 0.0 : static_cast<f64>(collisions) / static_cast<f64>(hits);
+
+                println(
+                    "{:<8} {} x {}-bit keys: {:>10} nodes {:>8} nps {:>10} hits {:>6} collisions ({:.4f}%)",
+                    ttLayoutName(layout),
+                    searcher.ttable().entriesPerCluster(),
+                    searcher.ttable().keyBits(),
+                    nodes,
+                    static_cast<usize>(static_cast<f64>(nodes) / time),
+                    hits,
+                    collisions,
+                    collisionRate * 100.0
+                );
+            }
+        );
+
+        static constexpr auto kShallowSizesKib = std::array<usize, 4>{0, 128, 512, 2048};
+
+        runModes<usize>(
+            depth,
+            ttSize,
+            kShallowSizesKib,
+            [](usize shallowSize, search::Searcher& searcher) { searcher.setTtShallowSize(shallowSize); },
+            [](usize shallowSize, const search::Searcher&, const search::ThreadData&, f64 time, usize nodes) {
+                println(
+                    "shallow {:>4} KiB: {:>10} nodes {:>8.3f} s {:>8} nps",
+                    shallowSize,
+                    nodes,
+                    time,
+                    static_cast<usize>(static_cast<f64>(nodes) / time)
+                );
+            }
+        );
+    }
+
+    void runEvalCache(i32 depth, usize ttSize) {
+        if (!eval::isNetworkLoaded()) {
+            eprintln("No network loaded");
+            return;
+        }
+
+        static constexpr auto kEnabled = std::array{false, true};
+
+        const auto prevEvalCache = g_opts.evalCache;
+
+        println("depth {}, {} MiB", depth, ttSize);
+
+        runModes<bool>(
+            depth,
+            ttSize,
+            kEnabled,
+            [](bool enabled, search::Searcher&) { opts::mutableOpts().evalCache = enabled; },
+            [](bool enabled, const search::Searcher&, const search::ThreadData& thread, f64 time, usize nodes) {
+                const auto [probes, hits] = thread.nnueState.evalCacheStats();
+
+                println(
+                    "eval cache {:<3}: {:>10} nodes {:>8.3f} s {:>8} nps {:>10} hits of {:>10} probes ({:.2f}%)",
+                    enabled ? "on" : "off",
+                    nodes,
+                    time,
+                    static_cast<usize>(static_cast<f64>(nodes) / time),
+                    hits,
+                    probes,
+                    probes == 0 ? 0.0 : static_cast<f64>(hits) * 100.0 / static_cast<f64>(probes)
+                );
+            }
+        );
+
+        opts::mutableOpts().evalCache = prevEvalCache;
+    }
+
+    void runEvalPages(i32 depth, usize ttSize) {
+        if (!eval::isNetworkLoaded()) {
+            eprintln("No network loaded");
+            return;
+        }
+
+        static constexpr auto kPageModes = std::array{
+            util::PageMode::kPlain,
+            util::PageMode::kTransparent,
+            util::PageMode::kHuge2Mib,
+            util::PageMode::kHuge1Gib,
+        };
+
+        const auto prevPageMode = eval::networkPageMode();
+
+        println("depth {}, {} MiB", depth, ttSize);
+
+        runModes<util::PageMode>(
+            depth,
+            ttSize,
+            kPageModes,
+            [](util::PageMode mode, search::Searcher&) { eval::setNetworkPageMode(mode); },
+            [](util::PageMode mode, const search::Searcher&, const search::ThreadData&, f64 time, usize nodes) {
+                println(
+                    "{:<6} ({:<22}): {:>10} nodes {:>8.3f} s {:>8} nps",
+                    util::pageModeName(mode),
+                    util::pageBackingName(eval::networkPageBacking()),
+                    nodes,
+                    time,
+                    static_cast<usize>(static_cast<f64>(nodes) / time)
+                );
+            }
+        );
+
+        eval::setNetworkPageMode(prevPageMode);
+    }
+
+    void runLatency(u32 maxThreads) {
+        if (!eval::isNetworkLoaded()) {
+            eprintln("No network loaded");
+            return;
+        }
+
+        static constexpr u32 kRounds = 25;
+        static constexpr auto kSearchTime = std::chrono::milliseconds{20};
+
+        if (maxThreads == 0) {
+            maxThreads = opts::kThreadCountRange.clamp(std::thread::hardware_concurrency());
+        }
+
+        const auto prevChess960 = g_opts.chess960;
+
+        opts::mutableOpts().chess960 = false;
+
+        const auto pos = *Position::fromFen(kStandardFens[0]);
+
+        std::vector<u32> threadCounts{};
+
+        for (u32 threads = 1; threads < maxThreads; threads *= 2) {
+            threadCounts.push_back(threads);
+        }
+
+        threadCounts.push_back(maxThreads);
+
+        // median, max
+        const auto summarise = [](std::vector<f64>& latencies) {
+            std::ranges::sort(latencies);
+            return std::pair{latencies[latencies.size() / 2] * 1e6, latencies.back() * 1e6};
+        };
+
+        println("{} rounds per thread count, latencies in us", kRounds);
+        println("{:>7} {:>12} {:>12} {:>14} {:>14}", "threads", "go median", "go max", "stop median", "stop max");
+
+        for (const auto threadCount : threadCounts) {
+            search::Searcher searcher{kDefaultBenchTtSize};
+
+            searcher.setThreads(threadCount);
+            searcher.setMaxDepth(kMaxDepth);
+            searcher.setSilent(true);
+
+            // not timed
+            searcher.newGame();
+            searcher.ensureReady();
+
+            std::vector<f64> goLatencies{};
+            std::vector<f64> stopLatencies{};
+
+            for (u32 round = 0; round < kRounds; ++round) {
+                const auto goStart = util::Instant::now();
+
+                searcher.setLimiter(limit::SearchLimiter{goStart});
+                searcher.startSearch(pos, {}, goStart, {}, true);
+
+                // every thread has set up its root position and accumulators and is about to search
+                while (searcher.startedThreads() < threadCount) {
+                    std::this_thread::yield();
+                }
+
+                goLatencies.push_back(goStart.elapsed());
+
+                std::this_thread::sleep_for(kSearchTime);
+
+                const auto stopStart = util::Instant::now();
+
+                searcher.stop();
+
+                // the main thread has picked and reported the best move
+                while (searcher.searching()) {
+                    std::this_thread::yield();
+                }
+
+                stopLatencies.push_back(stopStart.elapsed());
+            }
+
+            const auto [goMedian, goMax] = summarise(goLatencies);
+            const auto [stopMedian, stopMax] = summarise(stopLatencies);
+
+            println(
+                "{:>7} {:>12.1f} {:>12.1f} {:>14.1f} {:>14.1f}",
+                threadCount,
+                goMedian,
+                goMax,
+                stopMedian,
+                stopMax
+            );
+        }
+
+        opts::mutableOpts().chess960 = prevChess960;
+    }
+
+    void runScaling(const ScalingBenchConfig& config) {
+        if (!eval::isNetworkLoaded()) {
+            eprintln("No network loaded");
+            return;
+        }
+
+        struct PositionResult {
+            f64 time{};
+            usize nodes{};
+            std::vector<usize> threadNodes{};
+            std::vector<f64> depthTimes{};
+        };
+
+        struct ThreadCountResult {
+            u32 threads{};
+            f64 time{};
+            usize nodes{};
+            f64 nps{};
+            f64 npsScaling{};
+            f64 threadNpsMin{};
+            f64 threadNpsMax{};
+            f64 threadNpsImbalance{};
+            f64 avgDepth{};
+            usize ttdPositions{};
+            f64 ttdSpeedup{};
+        };
+
+        const auto maxThreads = config.maxThreads == 0
+                                  ? opts::kThreadCountRange.clamp(std::thread::hardware_concurrency())
+                                  : config.maxThreads;
+
+        const auto prevMinimal = g_opts.minimal;
+        const auto prevChess960 = g_opts.chess960;
+
+        opts::mutableOpts().minimal = true;
+
+        std::vector<std::pair<std::string_view, bool>> fens{};
+
+        for (const auto fen : kStandardFens) {
+            fens.emplace_back(fen, false);
+        }
+
+        for (const auto fen : kFrcFens) {
+            fens.emplace_back(fen, true);
+        }
+
+        std::vector<u32> threadCounts{};
+
+        for (u32 threads = 1; threads < maxThreads; threads *= 2) {
+            threadCounts.push_back(threads);
+        }
+
+        threadCounts.push_back(maxThreads);
+
+        search::Searcher searcher{config.ttSize};
+
+        searcher.setMaxDepth(kMaxDepth);
+        searcher.setSilent(true);
+
+        const auto searchPosition = [&](std::string_view fen, bool frc) {
+            opts::mutableOpts().chess960 = frc;
+
+            const auto pos = *Position::fromFen(fen);
+
+            // not timed
+            searcher.newGame();
+            searcher.ensureReady();
+
+            const auto startTime = util::Instant::now();
+
+            limit::SearchLimiter limiter{startTime};
+
+            if (config.nodes > 0) {
+                limiter.setHardNodes(config.nodes);
+            } else {
+                limiter.setMoveTime(static_cast<f64>(config.moveTimeMs) / 1000.0);
+            }
+
+            searcher.setLimiter(limiter);
+            searcher.startSearch(pos, {}, startTime, {}, false);
+
+            searcher.waitForStop();
+
+            PositionResult result{.time = startTime.elapsed()};
+
+            // the main thread has finished reporting once this is clear
+            while (searcher.searching()) {
+                std::this_thread::yield();
+            }
+
+            result.threadNodes = searcher.threadNodes();
+            result.nodes = std::accumulate(result.threadNodes.begin(), result.threadNodes.end(), usize{0});
+
+            const auto depthTimes = searcher.depthTimes();
+            result.depthTimes.assign(depthTimes.begin(), depthTimes.end());
+
+            return result;
+        };
+
+        const auto printCsv = [](const ThreadCountResult& result) {
+            println(
+                "{},{:.3f},{},{:.0f},{:.3f},{:.0f},{:.0f},{:.4f},{:.2f},{},{:.3f}",
+                result.threads,
+                result.time,
+                result.nodes,
+                result.nps,
+                result.npsScaling,
+                result.threadNpsMin,
+                result.threadNpsMax,
+                result.threadNpsImbalance,
+                result.avgDepth,
+                result.ttdPositions,
+                result.ttdSpeedup
+            );
+        };
+
+        std::vector<PositionResult> baseline{};
+        std::vector<ThreadCountResult> results{};
+
+        if (!config.json) {
+            println(
+                "threads,seconds,nodes,nps,nps_scaling,thread_nps_min,thread_nps_max,"
+                "thread_nps_imbalance,avg_depth,ttd_positions,ttd_speedup"
+            );
+        }
+
+        for (const auto threadCount : threadCounts) {
+            searcher.setThreads(threadCount);
+
+            std::vector<PositionResult> positions{};
+            positions.reserve(fens.size());
+
+            for (const auto& [fen, frc] : fens) {
+                positions.push_back(searchPosition(fen, frc));
+            }
+
+            if (baseline.empty()) {
+                baseline = positions;
+            }
+
+            ThreadCountResult result{.threads = threadCount};
+
+            std::vector<usize> threadNodes(threadCount);
+
+            f64 depthSum = 0.0;
+            f64 ttdLogSum = 0.0;
+
+            for (usize i = 0; i < positions.size(); ++i) {
+                const auto& position = positions[i];
+
+                result.time += position.time;
+                result.nodes += position.nodes;
+
+                for (u32 threadIdx = 0; threadIdx < threadCount; ++threadIdx) {
+                    threadNodes[threadIdx] += position.threadNodes[threadIdx];
+                }
+
+                depthSum += static_cast<f64>(position.depthTimes.size());
+
+                // time to the deepest depth 1 thread completed, if this run got there too
+                const auto targetDepth = baseline[i].depthTimes.size();
+
+                if (targetDepth > 0 && position.depthTimes.size() >= targetDepth) {
+                    ttdLogSum += std::log(baseline[i].depthTimes[targetDepth - 1])
+                               - std::log(position.depthTimes[targetDepth - 1]);
+                    ++result.ttdPositions;
+                }
+            }
+
+            result.nps = static_cast<f64>(result.nodes) / result.time;
+            result.npsScaling = results.empty() ? 1.0 : result.nps / results.front().nps;
+
+            const auto [minNodes, maxNodes] = std::ranges::minmax(threadNodes);
+
+            result.threadNpsMin = static_cast<f64>(minNodes) / result.time;
+            result.threadNpsMax = static_cast<f64>(maxNodes) / result.time;
+            result.threadNpsImbalance =
+                (result.threadNpsMax - result.threadNpsMin) / (result.nps / static_cast<f64>(threadCount));
+
+            result.avgDepth = depthSum / static_cast<f64>(positions.size());
+            result.ttdSpeedup =
+                result.ttdPositions == 0 ? 0.0 : std::exp(ttdLogSum / static_cast<f64>(result.ttdPositions));
+
+            results.push_back(result);
+
+            if (!config.json) {
+                printCsv(result);
+            }
+        }
+
+        if (config.json) {
+            println("{{");
+
+            if (config.nodes > 0) {
+                println("  \"limit\": {{\"nodes\": {}}},", config.nodes);
+            } else {
+                println("  \"limit\": {{\"movetime_ms\": {}}},", config.moveTimeMs);
+            }
+
+            println("  \"hash_mib\": {},", config.ttSize);
+            println("  \"positions\": {},", fens.size());
+            println("  \"results\": [");
+
+            for (usize i = 0; i < results.size(); ++i) {
+                const auto& result = results[i];
+
+                println(
+                    "    {{\"threads\": {}, \"seconds\": {:.3f}, \"nodes\": {}, \"nps\": {:.0f}, "
+                    "\"nps_scaling\": {:.3f}, \"thread_nps_min\": {:.0f}, \"thread_nps_max\": {:.0f}, "
+                    "\"thread_nps_imbalance\": {:.4f}, \"avg_depth\": {:.2f}, \"ttd_positions\": {}, "
+                    "\"ttd_speedup\": {:.3f}}}{}",
+                    result.threads,
+                    result.time,
+                    result.nodes,
+                    result.nps,
+                    result.npsScaling,
+                    result.threadNpsMin,
+                    result.threadNpsMax,
+                    result.threadNpsImbalance,
+                    result.avgDepth,
+                    result.ttdPositions,
+                    result.ttdSpeedup,
+                    i + 1 < results.size() ? "," : ""
+                );
+            }
+
+            println("  ]");
+            println("}}");
+        }
+
+        opts::mutableOpts().minimal = prevMinimal;
+        opts::mutableOpts().chess960 = prevChess960;
+    }
+
+    std::span<const std::string_view> standardFens() {
+        return kStandardFens;
     }
 } // namespace stormphrax::bench
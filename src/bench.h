@@ -20,6 +20,9 @@
 
 #include "types.h"
 
+#include <span>
+#include <string_view>
+
 #include "search.h"
 
 namespace stormphrax::bench {
@@ -31,5 +34,47 @@ namespace stormphrax::bench {
 
     constexpr usize kDefaultBenchTtSize = 16;
 
-    void run(i32 depth = kDefaultBenchDepth, usize ttSize = kDefaultBenchTtSize);
+    // verbose additionally prints the network's page backing, and eval cache and accumulator
+    // update path statistics. Off by default to keep the output format scripts rely on
+    void run(i32 depth = kDefaultBenchDepth, usize ttSize = kDefaultBenchTtSize, bool verbose = false);
+
+    // Runs the bench positions once per TT layout, reporting speed and false-positive
+    // TT hits, then once per shallow table size, reporting speed and time to depth
+    void runTt(i32 depth = kDefaultBenchDepth, usize ttSize = kDefaultBenchTtSize);
+
+    // Runs the bench positions with and without the eval cache
+    void runEvalCache(i32 depth = kDefaultBenchDepth, usize ttSize = kDefaultBenchTtSize);
+
+    // Runs the bench positions once per network page mode, reporting speed and what each mode got
+    void runEvalPages(i32 depth = kDefaultBenchDepth, usize ttSize = kDefaultBenchTtSize);
+
+    // Times go until every search thread has started, and stop until the best move is
+    // reported, for thread counts doubling from 1 up to maxThreads, or the hardware thread count if 0
+    void runLatency(u32 maxThreads = 0);
+
+    constexpr u32 kDefaultScalingBenchMoveTimeMs = 500;
+    constexpr usize kDefaultScalingBenchTtSize = 256;
+
+    struct ScalingBenchConfig {
+        // 0 for the hardware thread count
+        u32 maxThreads{0};
+
+        // per position, with nodes taking precedence if nonzero. Like go nodes,
+        // nodes only counts the main thread's, so the total grows with thread count
+        u32 moveTimeMs{kDefaultScalingBenchMoveTimeMs};
+        usize nodes{0};
+
+        usize ttSize{kDefaultScalingBenchTtSize};
+
+        // CSV otherwise
+        bool json{false};
+    };
+
+    // Searches every bench position with a fixed limit at thread counts doubling from 1 up to the
+    // maximum, from a cleared TT each time. Reports total NPS and its scaling over 1 thread, the spread
+    // of NPS across threads, and the geometric mean speedup to reach the depth 1 thread reached
+    void runScaling(const ScalingBenchConfig& config = {});
+
+    // The non-FRC bench positions
+    [[nodiscard]] std::span<const std::string_view> standardFens();
 } // namespace stormphrax::bench
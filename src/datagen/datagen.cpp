@@ -250,7 +250,7 @@ namespace stormphrax::datagen {
 
                     const bool filtered = pos.isCheck() || pos.isNoisy(move);
 
-                    eval::UpdateContext ctx{};
+                    auto& ctx = thread.nnueState.immediateContext();
                     thread.keyHistory.push_back(pos.key());
                     pos = pos.applyMove(move, eval::BoardObserver{ctx});
                     thread.nnueState.applyImmediately(ctx, pos);
@@ -71,7 +71,7 @@ namespace stormphrax::eval {
         true>(const Position&, const Optimism&, std::span<const u64>, const CorrectionHistoryTable*, i32, i32*);
 
     Score staticEval(const Position& pos, NnueState& nnueState, const Contempt& contempt) {
-        const auto eval = nnueState.evaluate(pos, pos.stm());
+        const auto eval = nnueState.evaluateCached(pos);
         return adjustStatic(pos, contempt, eval);
     }
 
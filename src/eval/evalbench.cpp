@@ -0,0 +1,670 @@
+/*
+ * Stormphrax, a UCI chess engine
+ * Copyright (C) 2026 Ciekce
+ *
+ * Stormphrax is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Stormphrax is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Stormphrax. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "evalbench.h"
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+#include <memory>
+#include <span>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "../bench.h"
+#include "../movegen.h"
+#include "../position.h"
+#include "../util/rng.h"
+#include "../util/timer.h"
+#include "nnue.h"
+#include "nnue_state.h"
+
+namespace stormphrax::eval::evalbench {
+    namespace {
+        constexpr usize kKernelIterations = 1 << 20;
+        constexpr usize kFeatureSamples = 4096;
+
+        constexpr u64 kSeed = 0x5be4e7c4a9d0f1b3;
+
+        // steps recorded from each bench position, and how far the walk may stray from it
+        constexpr usize kReplaySteps = 16384;
+        constexpr usize kMaxReplayDepth = 24;
+
+        // games played out from each bench position through applyImmediately, and their length
+        constexpr usize kReplayGames = 16;
+        constexpr usize kReplayGamePlies = 256;
+
+        // every replay is timed this many times, keeping the fastest
+        constexpr usize kReplayRounds = 5;
+
+        // every bench position's threats are collected this many times from each perspective
+        constexpr usize kCollectionRounds = 2048;
+
+        // the marginal cost of a threat row is timed between these two update sizes
+        constexpr usize kFewThreatRows = 8;
+        constexpr usize kManyThreatRows = 32;
+
+#if SP_HAS_AVX512
+        constexpr std::string_view kSimdName = SP_HAS_VBMI2 ? "avx512 + vbmi2" : "avx512";
+#elif SP_HAS_AVX2
+        constexpr std::string_view kSimdName = "avx2";
+#elif SP_HAS_NEON
+        constexpr std::string_view kSimdName = SP_HAS_NEON_DOTPROD ? "neon + dotprod" : "neon";
+#else
+        constexpr std::string_view kSimdName = "none";
+#endif
+
+        using Type = FeatureTransformer::OutputType;
+
+        using Row = std::span<const Type, kL1Size>;
+        using Output = std::span<Type, kL1Size>;
+
+        // keeps the compiler from eliding stores to an accumulator that is never read
+        inline void clobber(const void* ptr) {
+            asm volatile("" : : "r"(ptr) : "memory");
+        }
+
+        // The plain loops the kernels replaced, as a baseline. Whatever
+        // the autovectoriser makes of these is what was there before
+        namespace scalar {
+            void subAdd(Row src, Output dst, Row sub, Row add) {
+                for (u32 i = 0; i < kL1Size; ++i) {
+                    dst[i] = src[i] + add[i] - sub[i];
+                }
+            }
+
+            void subSubAdd(Row src, Output dst, Row sub0, Row sub1, Row add) {
+                for (u32 i = 0; i < kL1Size; ++i) {
+                    dst[i] = src[i] + add[i] - sub0[i] - sub1[i];
+                }
+            }
+
+            void subSubAddAdd(Row src, Output dst, Row sub0, Row sub1, Row add0, Row add1) {
+                for (u32 i = 0; i < kL1Size; ++i) {
+                    dst[i] = src[i] + add0[i] - sub0[i] + add1[i] - sub1[i];
+                }
+            }
+
+            void addAddAddAdd(Output acc, Row add0, Row add1, Row add2, Row add3) {
+                for (u32 i = 0; i < kL1Size; ++i) {
+                    acc[i] += add0[i] + add1[i] + add2[i] + add3[i];
+                }
+            }
+
+            void subSubSubSub(Output acc, Row sub0, Row sub1, Row sub2, Row sub3) {
+                for (u32 i = 0; i < kL1Size; ++i) {
+                    acc[i] -= sub0[i] + sub1[i] + sub2[i] + sub3[i];
+                }
+            }
+
+            void add(Output acc, Row add) {
+                for (u32 i = 0; i < kL1Size; ++i) {
+                    acc[i] += add[i];
+                }
+            }
+
+            void sub(Output acc, Row sub) {
+                for (u32 i = 0; i < kL1Size; ++i) {
+                    acc[i] -= sub[i];
+                }
+            }
+
+            // copy, then widen each threat row into the accumulator separately
+            void threats(
+                Row src,
+                Output dst,
+                const FeatureTransformer& ft,
+                std::span<const u32> adds,
+                std::span<const u32> subs
+            ) {
+                std::ranges::copy(src, dst.begin());
+
+                for (const auto feature : adds) {
+                    const auto* row = &ft.threatWeights[feature * kL1Size];
+                    for (u32 i = 0; i < kL1Size; ++i) {
+                        dst[i] += row[i];
+                    }
+                }
+
+                for (const auto feature : subs) {
+                    const auto* row = &ft.threatWeights[feature * kL1Size];
+                    for (u32 i = 0; i < kL1Size; ++i) {
+                        dst[i] -= row[i];
+                    }
+                }
+            }
+        } // namespace scalar
+
+        // -> ns per call
+        template <typename F>
+        f64 time(const F& f) {
+            const auto start = util::Instant::now();
+
+            for (usize i = 0; i < kKernelIterations; ++i) {
+                f(i % (kFeatureSamples - 4));
+            }
+
+            return start.elapsed() * 1e9 / static_cast<f64>(kKernelIterations);
+        }
+
+        // A search-like walk from a bench position. Each step makes
+        // a move, or unmakes the last one if it is the null move
+        struct ReplaySequence {
+            Position root;
+            std::vector<Move> steps{};
+        };
+
+        [[nodiscard]] std::vector<Move> legalMoves(const Position& pos) {
+            ScoredMoveList moves{};
+            generateAll(moves, pos);
+
+            std::vector<Move> legal{};
+
+            for (const auto [move, score] : moves) {
+                if (pos.isLegal(move)) {
+                    legal.push_back(move);
+                }
+            }
+
+            return legal;
+        }
+
+        [[nodiscard]] ReplaySequence recordWalk(const Position& root, util::rng::Jsf64Rng& rng) {
+            ReplaySequence sequence{root};
+            sequence.steps.reserve(kReplaySteps);
+
+            std::vector<Position> positions{root};
+
+            while (sequence.steps.size() < kReplaySteps) {
+                const auto legal = legalMoves(positions.back());
+
+                const bool atRoot = positions.size() == 1;
+                const bool backtrack = positions.size() > kMaxReplayDepth || legal.empty() || rng.nextU32(3) == 0;
+
+                if (backtrack && !atRoot) {
+                    positions.pop_back();
+                    sequence.steps.push_back(kNullMove);
+                } else if (!legal.empty()) {
+                    const auto move = legal[rng.nextU32(legal.size())];
+                    positions.push_back(positions.back().applyMove(move));
+                    sequence.steps.push_back(move);
+                } else {
+                    break;
+                }
+            }
+
+            return sequence;
+        }
+
+        // A game played out from a bench position, for the applyImmediately path datagen takes
+        [[nodiscard]] ReplaySequence recordGame(const Position& root, util::rng::Jsf64Rng& rng) {
+            ReplaySequence sequence{root};
+
+            auto pos = root;
+
+            for (usize ply = 0; ply < kReplayGamePlies; ++ply) {
+                const auto legal = legalMoves(pos);
+
+                if (legal.empty()) {
+                    break;
+                }
+
+                const auto move = legal[rng.nextU32(legal.size())];
+
+                pos = pos.applyMove(move);
+                sequence.steps.push_back(move);
+            }
+
+            return sequence;
+        }
+
+        // Makes and unmakes moves the way search does, evaluating every position reached
+        // lazily through push and pop. Returns the number of positions evaluated
+        usize replayWalk(NnueState& state, const ReplaySequence& sequence, i64& evalSum) {
+            std::vector<Position> positions{sequence.root};
+            positions.reserve(kMaxReplayDepth + 2);
+
+            state.reset(sequence.root);
+
+            usize evals{};
+
+            for (const auto move : sequence.steps) {
+                if (move == kNullMove) {
+                    positions.pop_back();
+                    state.pop();
+                    continue;
+                }
+
+                const auto& pos = positions.emplace_back(positions.back().applyMove(move, state.push()));
+
+                evalSum += state.evaluate(pos, pos.stm());
+                ++evals;
+            }
+
+            return evals;
+        }
+
+        // Plays the moves the way datagen does, updating accumulators eagerly in place
+        usize replayGame(NnueState& state, const ReplaySequence& sequence, i64& evalSum) {
+            auto pos = sequence.root;
+
+            state.reset(pos);
+
+            for (const auto move : sequence.steps) {
+                auto& ctx = state.immediateContext();
+                pos = pos.applyMove(move, BoardObserver{ctx});
+                state.applyImmediately(ctx, pos);
+
+                evalSum += state.evaluate(pos, pos.stm());
+            }
+
+            return sequence.steps.size();
+        }
+
+        // average cost of taking a timestamp and reading the elapsed time, which profiled work includes
+        [[nodiscard]] f64 timerOverheadNs() {
+            constexpr usize kSamples = 1 << 16;
+
+            f64 sum{};
+
+            const auto start = util::Instant::now();
+
+            for (usize i = 0; i < kSamples; ++i) {
+                const auto inner = util::Instant::now();
+                sum += inner.elapsed();
+            }
+
+            clobber(&sum);
+
+            return start.elapsed() * 1e9 / static_cast<f64>(kSamples) / 2.0;
+        }
+
+        template <typename Replay>
+        void runReplayMode(
+            std::string_view name,
+            NnueState& state,
+            std::span<const ReplaySequence> sequences,
+            const Replay& replay,
+            f64 timerOverhead
+        ) {
+            usize evals{};
+            i64 evalSum{};
+
+            // unprofiled, for the overall cost of each evaluated position
+            f64 best = std::numeric_limits<f64>::max();
+
+            for (usize round = 0; round < kReplayRounds; ++round) {
+                evals = 0;
+                evalSum = 0;
+
+                const auto start = util::Instant::now();
+
+                for (const auto& sequence : sequences) {
+                    evals += replay(state, sequence, evalSum);
+                }
+
+                best = std::min(best, start.elapsed());
+            }
+
+            UpdateProfile profile{};
+
+            state.setProfile(&profile);
+
+            i64 profiledSum{};
+            for (const auto& sequence : sequences) {
+                replay(state, sequence, profiledSum);
+            }
+
+            state.setProfile(nullptr);
+
+            println();
+            println("{}: {} positions, {:.1f} ns per position", name, evals, best * 1e9 / static_cast<f64>(evals));
+
+            if (profiledSum != evalSum) {
+                println("  evals differ while profiling: {} != {}", profiledSum, evalSum);
+            }
+
+            constexpr std::array kWork = {
+                std::pair{ProfiledWork::kPsqUpdate, "psq update"},
+                std::pair{ProfiledWork::kThreatUpdate, "threat update"},
+                std::pair{ProfiledWork::kPsqRefresh, "psq refresh"},
+                std::pair{ProfiledWork::kThreatRefresh, "threat refresh"},
+                std::pair{ProfiledWork::kThreatRefreshAttempt, "threat refresh attempt"},
+                std::pair{ProfiledWork::kPropagate, "propagate"},
+            };
+
+            for (const auto& [work, workName] : kWork) {
+                const auto count = profile.counts[static_cast<usize>(work)];
+
+                if (count == 0) {
+                    continue;
+                }
+
+                println(
+                    "  {:<22} {:>10} x {:>8.1f} ns",
+                    workName,
+                    count,
+                    std::max(profile.nsPer(work) - timerOverhead, 0.0)
+                );
+            }
+
+            if constexpr (LayeredArch::kSparseL1) {
+                const auto propagations = profile.counts[static_cast<usize>(ProfiledWork::kPropagate)];
+
+                if (propagations > 0) {
+                    constexpr auto kChunks = kL1Size / sizeof(i32);
+
+                    const auto active = static_cast<f64>(profile.activeL1Chunks) / static_cast<f64>(propagations);
+                    println(
+                        "  L1 sparsity: {:.1f} of {} input chunks nonzero on average ({:.1f}%)",
+                        active,
+                        kChunks,
+                        active * 100.0 / static_cast<f64>(kChunks)
+                    );
+                }
+            }
+        }
+    } // namespace
+
+    void run() {
+        runReplay();
+        println();
+        runKernels();
+    }
+
+    void runReplay() {
+        if (!isNetworkLoaded()) {
+            eprintln("No network loaded");
+            return;
+        }
+
+        util::rng::Jsf64Rng rng{kSeed};
+
+        std::vector<ReplaySequence> walks{};
+        std::vector<ReplaySequence> games{};
+
+        for (const auto fen : bench::standardFens()) {
+            const auto root = Position::fromFen(fen);
+            assert(root);
+
+            walks.push_back(recordWalk(*root, rng));
+
+            for (usize game = 0; game < kReplayGames; ++game) {
+                games.push_back(recordGame(*root, rng));
+            }
+        }
+
+        const auto timerOverhead = timerOverheadNs();
+
+        println("network {}, simd {}", networkName(), kSimdName);
+        println("profiled times exclude {:.1f} ns of timer overhead", timerOverhead);
+
+        auto state = std::make_unique<NnueState>();
+        state->setNetwork(getNetwork(0));
+
+        runReplayMode("search (push/evaluate/pop)", *state, walks, replayWalk, timerOverhead);
+        runReplayMode("datagen (applyImmediately/evaluate)", *state, games, replayGame, timerOverhead);
+    }
+
+    void runKernels() {
+        if (!isNetworkLoaded()) {
+            eprintln("No network loaded");
+            return;
+        }
+
+        const auto& ft = getNetwork(0)->featureTransformer();
+
+        util::rng::Jsf64Rng rng{kSeed};
+
+        std::vector<u32> features(kFeatureSamples);
+        for (auto& feature : features) {
+            feature = rng.nextU32(FeatureTransformer::kPsqInputCount);
+        }
+
+        std::vector<u32> threatFeatures(kFeatureSamples);
+        for (auto& feature : threatFeatures) {
+            feature = rng.nextU32(InputFeatureSet::kThreatFeatures);
+        }
+
+        const auto row = [&](usize idx) {
+            return Row{&ft.psqWeights[features[idx] * kL1Size], kL1Size};
+        };
+
+        Accumulator src{};
+        src.initBoth(ft);
+
+        Accumulator simdAcc{};
+        Accumulator scalarAcc{};
+
+        const auto c = Colors::kWhite;
+
+        usize mismatches{};
+
+        const auto report = [&](std::string_view name, f64 simdNs, f64 scalarNs) {
+            bool match = true;
+
+            for (u32 i = 0; i < kL1Size; ++i) {
+                match &= simdAcc.forColor(c)[i] == scalarAcc.forColor(c)[i];
+            }
+
+            if (!match) {
+                ++mismatches;
+            }
+
+            println(
+                "{:<14} {:>8.2f} ns {:>8.2f} ns {:>6.2f}x{}",
+                name,
+                simdNs,
+                scalarNs,
+                scalarNs / simdNs,
+                match ? "" : "  MISMATCH"
+            );
+        };
+
+        const auto reset = [&] {
+            simdAcc.copyFrom(c, src);
+            scalarAcc.copyFrom(c, src);
+        };
+
+        println("{:<14} {:>11} {:>11} {:>7}", "kernel", "simd", "scalar", "speedup");
+
+        reset();
+        report(
+            "subAdd",
+            time([&](usize i) {
+                simdAcc.subAddFrom(src, ft, c, features[i], features[i + 1]);
+                clobber(&simdAcc);
+            }),
+            time([&](usize i) {
+                scalar::subAdd(src.forColor(c), scalarAcc.forColor(c), row(i), row(i + 1));
+                clobber(&scalarAcc);
+            })
+        );
+
+        reset();
+        report(
+            "subSubAdd",
+            time([&](usize i) {
+                simdAcc.subSubAddFrom(src, ft, c, features[i], features[i + 1], features[i + 2]);
+                clobber(&simdAcc);
+            }),
+            time([&](usize i) {
+                scalar::subSubAdd(src.forColor(c), scalarAcc.forColor(c), row(i), row(i + 1), row(i + 2));
+                clobber(&scalarAcc);
+            })
+        );
+
+        reset();
+        report(
+            "subSubAddAdd",
+            time([&](usize i) {
+                simdAcc.subSubAddAddFrom(src, ft, c, features[i], features[i + 1], features[i + 2], features[i + 3]);
+                clobber(&simdAcc);
+            }),
+            time([&](usize i) {
+                scalar::subSubAddAdd(
+                    src.forColor(c),
+                    scalarAcc.forColor(c),
+                    row(i),
+                    row(i + 1),
+                    row(i + 2),
+                    row(i + 3)
+                );
+                clobber(&scalarAcc);
+            })
+        );
+
+        // the in-place kernels accumulate over all iterations, identically for both
+        reset();
+        report(
+            "addAddAddAdd",
+            time([&](usize i) {
+                simdAcc.activateFourFeatures(ft, c, features[i], features[i + 1], features[i + 2], features[i + 3]);
+                clobber(&simdAcc);
+            }),
+            time([&](usize i) {
+                scalar::addAddAddAdd(scalarAcc.forColor(c), row(i), row(i + 1), row(i + 2), row(i + 3));
+                clobber(&scalarAcc);
+            })
+        );
+
+        reset();
+        report(
+            "subSubSubSub",
+            time([&](usize i) {
+                simdAcc.deactivateFourFeatures(ft, c, features[i], features[i + 1], features[i + 2], features[i + 3]);
+                clobber(&simdAcc);
+            }),
+            time([&](usize i) {
+                scalar::subSubSubSub(scalarAcc.forColor(c), row(i), row(i + 1), row(i + 2), row(i + 3));
+                clobber(&scalarAcc);
+            })
+        );
+
+        reset();
+        report(
+            "add",
+            time([&](usize i) {
+                simdAcc.activateFeature(ft, c, features[i]);
+                clobber(&simdAcc);
+            }),
+            time([&](usize i) {
+                scalar::add(scalarAcc.forColor(c), row(i));
+                clobber(&scalarAcc);
+            })
+        );
+
+        reset();
+        report(
+            "sub",
+            time([&](usize i) {
+                simdAcc.deactivateFeature(ft, c, features[i]);
+                clobber(&simdAcc);
+            }),
+            time([&](usize i) {
+                scalar::sub(scalarAcc.forColor(c), row(i));
+                clobber(&scalarAcc);
+            })
+        );
+
+        if constexpr (InputFeatureSet::kThreatInputs) {
+            // a typical quiet move changes a handful of threats in each direction. the
+            // window never overruns, as time() keeps i four below the sample count
+            constexpr usize kThreatsChanged = 3;
+
+            const auto adds = [&](usize i) {
+                return std::span<const u32>{&threatFeatures[i], kThreatsChanged};
+            };
+
+            const auto subs = [&](usize i) {
+                return std::span<const u32>{&threatFeatures[i + 1], kThreatsChanged};
+            };
+
+            reset();
+            report(
+                "threats",
+                time([&](usize i) {
+                    simdAcc.applyThreatsFrom(src, ft, c, adds(i), subs(i));
+                    clobber(&simdAcc);
+                }),
+                time([&](usize i) {
+                    scalar::threats(src.forColor(c), scalarAcc.forColor(c), ft, adds(i), subs(i));
+                    clobber(&scalarAcc);
+                })
+            );
+        }
+
+        if (mismatches > 0) {
+            println("{} kernels disagree with the scalar loops", mismatches);
+        }
+
+        if constexpr (InputFeatureSet::kThreatInputs) {
+            // the cost of collecting every threat on the board, in the threat
+            // rows the refresh cost model measures everything else in
+            const auto& network = *getNetwork(0);
+
+            std::vector<Position> positions{};
+
+            for (const auto fen : bench::standardFens()) {
+                positions.push_back(*Position::fromFen(fen));
+            }
+
+            ThreatFeatureList collected{};
+            usize threatCount{};
+
+            const auto start = util::Instant::now();
+
+            for (usize round = 0; round < kCollectionRounds; ++round) {
+                for (const auto& pos : positions) {
+                    for (const auto perspective : {Colors::kBlack, Colors::kWhite}) {
+                        collected.clear();
+                        collectThreatFeatures(network, collected, perspective, pos);
+                        std::ranges::sort(collected);
+
+                        threatCount += collected.size();
+                        clobber(&collected);
+                    }
+                }
+            }
+
+            const auto collections = static_cast<f64>(kCollectionRounds * positions.size() * 2);
+            const auto collectionNs = start.elapsed() * 1e9 / collections;
+
+            const auto rows = [&](usize count) {
+                return time([&](usize i) {
+                    const auto adds = std::span<const u32>{&threatFeatures[i % (kFeatureSamples - count)], count};
+                    simdAcc.applyThreatsFrom(src, ft, c, adds, {});
+                    clobber(&simdAcc);
+                });
+            };
+
+            const auto rowNs = (rows(kManyThreatRows) - rows(kFewThreatRows))
+                             / static_cast<f64>(kManyThreatRows - kFewThreatRows);
+
+            println();
+            println(
+                "threat collection: {:.1f} ns for {:.1f} threats, as much as {:.1f} threat rows at {:.2f} ns",
+                collectionNs,
+                static_cast<f64>(threatCount) / collections,
+                collectionNs / rowNs,
+                rowNs
+            );
+        }
+    }
+} // namespace stormphrax::eval::evalbench
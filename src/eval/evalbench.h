@@ -0,0 +1,34 @@
+/*
+ * Stormphrax, a UCI chess engine
+ * Copyright (C) 2026 Ciekce
+ *
+ * Stormphrax is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Stormphrax is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Stormphrax. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "../types.h"
+
+namespace stormphrax::eval::evalbench {
+    // Runs the replay benchmark, then the kernel benchmark
+    void run();
+
+    // Replays deterministic move sequences from the bench positions through NnueState, reporting
+    // the time per position and per incremental update, refresh and propagation, and L1 sparsity
+    void runReplay();
+
+    // Times the SIMD accumulator update kernels against the equivalent plain loops, then
+    // what collecting every threat in a position costs, in threat rows applied
+    void runKernels();
+} // namespace stormphrax::eval::evalbench
@@ -50,4 +50,15 @@ namespace stormphrax::eval {
     };
 
     static_assert(sizeof(NetworkHeader) == 64);
+
+    // Optionally follows the parameters of uncompressed networks whose threat weight rows are
+    // not in feature order, followed in turn by the row of each threat feature as a u16
+    constexpr std::array kThreatRowOrderMagic{'S', 'P', 'T', 'O'};
+
+    struct __attribute__((packed)) ThreatRowOrderHeader {
+        std::array<char, 4> magic{};
+        u32 rowCount{};
+    };
+
+    static_assert(sizeof(ThreatRowOrderHeader) == 8);
 } // namespace stormphrax::eval
@@ -18,18 +18,25 @@
 
 #include "nnue.h"
 
+#include <atomic>
 #include <cassert>
+#include <chrono>
 #include <cstring>
 #include <fstream>
 #include <memory>
+#include <string>
 #include <string_view>
+#include <vector>
 
 #include "../../3rdparty/zstd/zstd.h"
 
 #include "../attacks/attacks.h"
 #include "../util/align.h"
+#include "../util/mapped_file.h"
 #include "../util/memstream.h"
 #include "../util/numa/numa.h"
+#include "../util/pages.h"
+#include "../util/shared_memory.h"
 #include "header.h"
 #include "nnue/features/threats/geometry.h"
 #include "nnue/loader.h"
@@ -184,126 +191,515 @@ namespace stormphrax::eval {
             return true;
         }
 
-        // must manually allocate for alignment
-        std::byte* s_loadedNetworkData{nullptr};
+        // Weights are looked up more or less at random by feature index on every accumulator
+        // update, so they can be copied onto huge pages. Only done when asked for, as
+        // uncompressed networks otherwise need no copy at all
+        util::PageMode s_networkPageMode{kDefaultNetworkPageMode};
+
+        // private copy of the current network's weights, if it needed one
+        util::PageAllocation s_loadedNetworkData{};
+
+        // external network file, mapped for as long as it is loaded, as
+        // uncompressed networks are used straight out of the mapping
+        util::MappedFile s_networkFile{};
 
 #ifdef SP_USE_LIBNUMA
-        std::unique_ptr<numa::NumaUniqueAllocation<std::byte>> s_networkData{};
+        // one copy of the weights per node
+        std::vector<util::PageAllocation> s_networkData{};
         std::unique_ptr<numa::NumaUniqueAllocation<Network>> s_networks{};
+
+        void freeNetworkData(std::vector<util::PageAllocation>& data) {
+            for (auto& allocation : data) {
+                util::freePages(allocation);
+            }
+
+            data.clear();
+        }
 #else
         Network s_network{};
 #endif
 
         bool s_networkLoaded{false};
-    } // namespace
+        u64 s_networkGeneration{0};
 
-    void init() {
-        if (g_defaultNetSize < sizeof(NetworkHeader)) {
-            eprintln("Missing default network?");
-            return;
-        }
+        std::string s_networkName{};
 
-        const auto& header = *reinterpret_cast<const NetworkHeader*>(g_defaultNetData);
+        // row each threat feature's weights are stored in, empty if they are in feature order
+        std::vector<u16> s_threatRowOrder{};
 
-        if (!validate(header)) {
-            eprintln("Failed to validate default network header");
-            return;
+        void networkLoaded(const NetworkHeader& header, std::vector<u16> threatRowOrder) {
+            s_threatRowOrder = std::move(threatRowOrder);
+
+            const auto* order = s_threatRowOrder.empty() ? nullptr : s_threatRowOrder.data();
+
+#ifdef SP_USE_LIBNUMA
+            for (i32 node = 0; node < numa::nodeCount(); ++node) {
+                s_networks->get(node)->setThreatRowOrder(order);
+            }
+#else
+            s_network.setThreatRowOrder(order);
+#endif
+
+            s_networkName = std::string{header.name.data(), std::min<usize>(header.nameLen, header.name.size())};
+
+            s_networkLoaded = true;
+            ++s_networkGeneration;
         }
 
-        const auto networkSize = Network::byteSize();
+#if defined(SP_SHARED_NETWORK) && !defined(SP_USE_LIBNUMA)
+        // Decompressed and permuted networks are shared between running instances through a
+        // shared memory object named after the compressed network and the permutation in use.
+        // The first instance to load a network fills it in, later ones just map it read-only, and
+        // the last one to let go of it removes it. If the first one dies before finishing, the
+        // next one to come along recreates it
+        constexpr std::array kSharedNetworkMagic{'S', 'P', 'N', 'W'};
+        constexpr u32 kSharedNetworkVersion = 2;
+
+        // the header gets its own page, so that the network stays page-aligned
+        constexpr usize kSharedNetworkHeaderSize = 4096;
+
+        // decompressing and permuting takes a while
+        constexpr auto kSharedNetworkReadyTimeout = std::chrono::seconds{10};
+
+        // once to recreate an object whose creator died
+        constexpr u32 kSharedNetworkAttempts = 2;
+
+        struct SharedNetworkHeader {
+            std::array<char, 4> magic;
+            u32 version;
+            u64 key;
+            u64 networkSize;
+            std::atomic<u32> ready;
+        };
 
-        const bool compressed = testFlags(header.flags, NetworkFlags::kZstdCompressed);
+        static_assert(sizeof(SharedNetworkHeader) <= kSharedNetworkHeaderSize);
 
-        const std::byte* ptr;
+        struct SharedNetwork {
+            util::SharedMapping mapping{};
+            std::string name{};
+        };
 
-        if (compressed) {
-#ifndef SP_USE_LIBNUMA
-            eprintln("Warning: default network is compressed and will not be shared between running instances");
-#endif
+        SharedNetwork s_sharedNetwork{};
+
+        // Identifies the decompressed network, as laid out by this build
+        [[nodiscard]] u64 sharedNetworkKey(const std::byte* data, usize size) {
+            constexpr u64 kMul = 0x9e3779b97f4a7c15;
+
+            u64 key = 0xcbf29ce484222325;
 
-            s_networkLoaded = false;
+            const auto mix = [&](u64 v) {
+                key = (key ^ v) * kMul;
+                key ^= key >> 29;
+            };
+
+            usize i = 0;
 
-            if (!s_loadedNetworkData) {
-                s_loadedNetworkData = util::alignedAlloc<std::byte>(util::simd::kAlignment, networkSize);
+            for (; i + sizeof(u64) <= size; i += sizeof(u64)) {
+                u64 word;
+                std::memcpy(&word, data + i, sizeof(u64));
+                mix(word);
             }
 
-            const auto decompressedSize = ZSTD_decompress(
-                s_loadedNetworkData,
-                networkSize,
-                g_defaultNetData + sizeof(NetworkHeader),
-                g_defaultNetSize - sizeof(NetworkHeader)
-            );
+            for (; i < size; ++i) {
+                mix(static_cast<u64>(data[i]));
+            }
 
-            if (ZSTD_isError(decompressedSize)) {
-                eprintln("Failed to decompress default network: {}", ZSTD_getErrorName(decompressedSize));
-                return;
+            mix(size);
+
+            mix(util::simd::kPackNonSequential);
+            mix(util::simd::kPackGrouping);
+
+            for (const auto idx : util::simd::kPackOrdering) {
+                mix(static_cast<u64>(idx));
             }
 
-            if (decompressedSize < networkSize) {
-                eprintln("Decompressed default network too small? {} < {}", decompressedSize, networkSize);
+            return key;
+        }
+
+        void releaseSharedNetwork(SharedNetwork& shared) {
+            if (!shared.mapping.ptr) {
                 return;
             }
 
-            ptr = s_loadedNetworkData;
-        } else {
-            const auto defaultNetSize = g_defaultNetSize - sizeof(NetworkHeader);
+            util::releaseShared(shared.mapping, shared.name);
+            shared = SharedNetwork{};
+        }
 
-            if (defaultNetSize < networkSize) {
-                eprintln("Default network too small? {} < {}", defaultNetSize, networkSize);
-                return;
+        // Loads the compressed network in data out of its shared memory object, decompressing
+        // it into a new one if no other instance has yet. Fails if the object cannot be used
+        bool loadSharedNetwork(Network& network, SharedNetwork& shared, const std::byte* data, usize size) {
+            const auto networkSize = Network::byteSize();
+
+            const auto key = sharedNetworkKey(data + sizeof(NetworkHeader), size - sizeof(NetworkHeader));
+            auto name = fmt::format("stormphrax-net-{:016x}", key);
+
+            for (u32 attempt = 0; attempt < kSharedNetworkAttempts; ++attempt) {
+                // only returns once the creator, if any, has finished or died
+                auto mapping =
+                    util::mapShared(name, kSharedNetworkHeaderSize + networkSize, kSharedNetworkReadyTimeout);
+
+                if (!mapping) {
+                    return false;
+                }
+
+                auto* header = static_cast<SharedNetworkHeader*>(mapping->ptr);
+                auto* networkData = static_cast<std::byte*>(mapping->ptr) + kSharedNetworkHeaderSize;
+
+                if (mapping->created) {
+                    header->magic = kSharedNetworkMagic;
+                    header->version = kSharedNetworkVersion;
+                    header->key = key;
+                    header->networkSize = networkSize;
+
+                    const auto decompressedSize = ZSTD_decompress(
+                        networkData,
+                        networkSize,
+                        data + sizeof(NetworkHeader),
+                        size - sizeof(NetworkHeader)
+                    );
+
+                    nnue::NetworkLoader loader{networkData, networkSize};
+
+                    // permutes the shared copy in place
+                    if (ZSTD_isError(decompressedSize) || decompressedSize < networkSize
+                        || !network.loadFrom(loader, false))
+                    {
+                        util::releaseShared(*mapping, name);
+                        return false;
+                    }
+
+                    header->ready.store(1, std::memory_order::release);
+                    util::publishShared(*mapping);
+                } else {
+                    const bool headerFits = mapping->size >= kSharedNetworkHeaderSize;
+
+                    if (headerFits && header->ready.load(std::memory_order::acquire) == 0) {
+                        util::releaseShared(*mapping, name);
+                        continue;
+                    }
+
+                    if (!headerFits || mapping->size != kSharedNetworkHeaderSize + networkSize
+                        || header->magic != kSharedNetworkMagic || header->version != kSharedNetworkVersion
+                        || header->key != key || header->networkSize != networkSize)
+                    {
+                        util::unmapShared(*mapping);
+                        return false;
+                    }
+
+                    // already permuted by whichever instance created it
+                    nnue::NetworkLoader loader{networkData, networkSize};
+                    if (!network.loadFrom(loader, true)) {
+                        util::unmapShared(*mapping);
+                        return false;
+                    }
+                }
+
+                // nothing writes to it from here on, whichever instance filled it in
+                util::protectShared(*mapping);
+
+                shared.mapping = *mapping;
+                shared.name = std::move(name);
+
+                return true;
+            }
+
+            return false;
+        }
+#endif
+
+        // Reads the threat row order that may follow the parameters of an uncompressed network.
+        // Anything else after them is ignored
+        bool readThreatRowOrder(std::vector<u16>& dst, const std::byte* data, usize size, std::string_view source) {
+            if constexpr (!InputFeatureSet::kThreatInputs) {
+                return true;
+            }
+
+            ThreatRowOrderHeader header{};
+
+            if (size < sizeof(ThreatRowOrderHeader)) {
+                return true;
             }
 
-            s_networkLoaded = false;
+            std::memcpy(&header, data, sizeof(ThreatRowOrderHeader));
 
-            if (s_loadedNetworkData) {
-                util::alignedFree(s_loadedNetworkData);
-                s_loadedNetworkData = nullptr;
+            if (header.magic != kThreatRowOrderMagic) {
+                return true;
             }
 
-            ptr = g_defaultNetData + sizeof(NetworkHeader);
+            if (header.rowCount != InputFeatureSet::kThreatFeatures
+                || size - sizeof(ThreatRowOrderHeader) < header.rowCount * sizeof(u16))
+            {
+                eprintln("Invalid threat row order in {} network", source);
+                return false;
+            }
+
+            dst.resize(header.rowCount);
+            std::memcpy(dst.data(), data + sizeof(ThreatRowOrderHeader), header.rowCount * sizeof(u16));
+
+            if (!nnue::features::threats::isValidRowOrder(dst)) {
+                eprintln("Invalid threat row order in {} network", source);
+                return false;
+            }
+
+            return true;
         }
 
+        // Validates and loads the network in data, which starts with its header. Uncompressed networks
+        // are expected to be prepermuted, and are only used in place when no copy of them is needed,
+        // either on huge pages or on each NUMA node. The current network is left untouched if loading fails
+        bool loadFromBuffer(const std::byte* data, usize size, std::string_view source) {
+            if (size < sizeof(NetworkHeader)) {
+                eprintln("Missing {} network?", source);
+                return false;
+            }
+
+            const auto& header = *reinterpret_cast<const NetworkHeader*>(data);
+
+            if (!validate(header)) {
+                eprintln("Failed to validate {} network header", source);
+                return false;
+            }
+
+            const auto networkSize = Network::byteSize();
+
+            const bool compressed = testFlags(header.flags, NetworkFlags::kZstdCompressed);
+
+            const std::byte* ptr;
+
+            // private copy of the weights, if any
+            util::PageAllocation weights{};
+
+            // empty if the threat weights are in feature order
+            std::vector<u16> threatRowOrder{};
+
+#if defined(SP_SHARED_NETWORK) && !defined(SP_USE_LIBNUMA)
+            if (compressed) {
+                Network network{};
+                SharedNetwork shared{};
+
+                if (loadSharedNetwork(network, shared, data, size)) {
+                    s_network = network;
+
+                    releaseSharedNetwork(s_sharedNetwork);
+                    s_sharedNetwork = std::move(shared);
+
+                    util::freePages(s_loadedNetworkData);
+
+                    networkLoaded(header, {});
+                    return true;
+                }
+
+                // fall back to a private copy
+            }
+#endif
+
+            if (compressed) {
+#ifndef SP_USE_LIBNUMA
+                eprintln("Warning: {} network is compressed and will not be shared between running instances", source);
+#endif
+
+                weights = util::allocatePages(networkSize, s_networkPageMode);
+
+                if (!weights.ptr) {
+                    eprintln("Failed to allocate {} network - out of memory?", source);
+                    return false;
+                }
+
+                const auto decompressedSize = ZSTD_decompress(
+                    weights.ptr,
+                    networkSize,
+                    data + sizeof(NetworkHeader),
+                    size - sizeof(NetworkHeader)
+                );
+
+                if (ZSTD_isError(decompressedSize)) {
+                    eprintln("Failed to decompress {} network: {}", source, ZSTD_getErrorName(decompressedSize));
+                    util::freePages(weights);
+                    return false;
+                }
+
+                if (decompressedSize < networkSize) {
+                    eprintln("Decompressed {} network too small? {} < {}", source, decompressedSize, networkSize);
+                    util::freePages(weights);
+                    return false;
+                }
+
+                ptr = static_cast<const std::byte*>(weights.ptr);
+            } else {
+                const auto dataSize = size - sizeof(NetworkHeader);
+
+                if (dataSize < networkSize) {
+                    eprintln("{} network too small? {} < {}", source, dataSize, networkSize);
+                    return false;
+                }
+
+                ptr = data + sizeof(NetworkHeader);
+
+                if (!readThreatRowOrder(threatRowOrder, ptr + networkSize, dataSize - networkSize, source)) {
+                    return false;
+                }
+            }
+
 #ifdef SP_USE_LIBNUMA
-        s_networks = std::make_unique<numa::NumaUniqueAllocation<Network>>();
-        s_networkData = std::make_unique<numa::NumaUniqueAllocation<std::byte>>(networkSize);
-
-        const auto nodeCount = numa::nodeCount();
-        for (i32 node = 0; node < nodeCount; ++node) {
-            auto* target = s_networkData->get(node);
-            std::memcpy(target, ptr, networkSize);
-            nnue::NetworkLoader loader{target, networkSize};
-            if (!s_networks->get(node)->loadFrom(loader, !compressed)) {
-                eprintln("Failed to load default network on NUMA node {}", node);
-                return;
+            auto networks = std::make_unique<numa::NumaUniqueAllocation<Network>>();
+
+            std::vector<util::PageAllocation> networkData{};
+
+            const auto nodeCount = numa::nodeCount();
+            networkData.reserve(nodeCount);
+
+            for (i32 node = 0; node < nodeCount; ++node) {
+                auto& copy = networkData.emplace_back(util::allocatePages(networkSize, s_networkPageMode));
+
+                if (!copy.ptr) {
+                    eprintln("Failed to allocate {} network on NUMA node {} - out of memory?", source, node);
+                    freeNetworkData(networkData);
+                    util::freePages(weights);
+                    return false;
+                }
+
+                // before the copy below first touches it
+                numa::bindMemory(copy.ptr, copy.size, node);
+
+                auto* target = static_cast<std::byte*>(copy.ptr);
+                std::memcpy(target, ptr, networkSize);
+
+                nnue::NetworkLoader loader{target, networkSize};
+                if (!networks->get(node)->loadFrom(loader, !compressed)) {
+                    eprintln("Failed to load {} network on NUMA node {}", source, node);
+                    freeNetworkData(networkData);
+                    util::freePages(weights);
+                    return false;
+                }
             }
-        }
 
-        if (s_loadedNetworkData) {
-            util::alignedFree(s_loadedNetworkData);
-            s_loadedNetworkData = nullptr;
-        }
+            // every node has its own copy now
+            util::freePages(weights);
+
+            s_networks = std::move(networks);
+
+            freeNetworkData(s_networkData);
+            s_networkData = std::move(networkData);
 #else
-        nnue::NetworkLoader loader{ptr, networkSize};
-        if (!s_network.loadFrom(loader, !compressed)) {
+            if (!compressed && s_networkPageMode != util::PageMode::kPlain) {
+                weights = util::allocatePages(networkSize, s_networkPageMode);
+
+                if (!weights.ptr) {
+                    eprintln("Failed to allocate {} network - out of memory?", source);
+                    return false;
+                }
+
+                std::memcpy(weights.ptr, ptr, networkSize);
+                ptr = static_cast<const std::byte*>(weights.ptr);
+            }
+
+            Network network{};
+
+            nnue::NetworkLoader loader{ptr, networkSize};
+            if (!network.loadFrom(loader, !compressed)) {
+                eprintln("Failed to load {} network", source);
+                util::freePages(weights);
+                return false;
+            }
+
+            s_network = network;
+
+            util::freePages(s_loadedNetworkData);
+            s_loadedNetworkData = weights;
+
+    #ifdef SP_SHARED_NETWORK
+            releaseSharedNetwork(s_sharedNetwork);
+    #endif
+#endif
+
+            networkLoaded(header, std::move(threatRowOrder));
+            return true;
+        }
+    } // namespace
+
+    void init() {
+        if (!loadFromBuffer(g_defaultNetData, g_defaultNetSize, "default")) {
             eprintln("Failed to load default network");
+        }
+    }
+
+    bool loadNetworkFile(const std::string& path) {
+        if (path.empty() || path == "<internal>") {
+            if (!loadFromBuffer(g_defaultNetData, g_defaultNetSize, "default")) {
+                return false;
+            }
+
+            util::unmapFile(s_networkFile);
+            return true;
+        }
+
+        auto file = util::mapFile(path);
+
+        if (!file) {
+            eprintln("Failed to open network file {}", path);
+            return false;
+        }
+
+        if (!loadFromBuffer(file->data, file->size, path)) {
+            util::unmapFile(*file);
+            return false;
+        }
+
+        // nothing refers to the previous file any more
+        util::unmapFile(s_networkFile);
+        s_networkFile = *file;
+
+        return true;
+    }
+
+    void setNetworkPageMode(util::PageMode mode) {
+        if (mode == s_networkPageMode) {
             return;
         }
+
+        s_networkPageMode = mode;
+
+        if (!s_networkLoaded) {
+            return;
+        }
+
+        // reload whatever is currently loaded onto the new pages
+        if (s_networkFile.data) {
+            loadFromBuffer(s_networkFile.data, s_networkFile.size, "current");
+        } else {
+            loadFromBuffer(g_defaultNetData, g_defaultNetSize, "default");
+        }
+    }
+
+    util::PageMode networkPageMode() {
+        return s_networkPageMode;
+    }
+
+    util::PageBacking networkPageBacking() {
+#ifdef SP_USE_LIBNUMA
+        const auto backing = s_networkData.empty() ? util::PageBacking::kNone : s_networkData[0].backing;
+#else
+        const auto backing = s_loadedNetworkData.backing;
 #endif
 
-        s_networkLoaded = true;
+        // used in place otherwise
+        return backing == util::PageBacking::kNone ? util::PageBacking::kPlain : backing;
     }
 
     void shutdown() {
-        if (s_loadedNetworkData) {
-            util::alignedFree(s_loadedNetworkData);
-            s_loadedNetworkData = nullptr;
-        }
+        util::freePages(s_loadedNetworkData);
 
 #ifdef SP_USE_LIBNUMA
-        s_networkData = nullptr;
+        freeNetworkData(s_networkData);
         s_networks = nullptr;
 #endif
 
+        util::unmapFile(s_networkFile);
+
+#if defined(SP_SHARED_NETWORK) && !defined(SP_USE_LIBNUMA)
+        releaseSharedNetwork(s_sharedNetwork);
+#endif
+
         s_networkLoaded = false;
     }
 
@@ -320,18 +716,37 @@ namespace stormphrax::eval {
 #endif
     }
 
+    u64 networkGeneration() {
+        return s_networkGeneration;
+    }
+
+    std::string_view networkName() {
+        return s_networkName;
+    }
+
     std::string_view defaultNetworkName() {
         const auto& header = *reinterpret_cast<const NetworkHeader*>(g_defaultNetData);
         return {header.name.data(), header.nameLen};
     }
 
     void addThreatFeatures(const Network& network, std::span<i16, kL1Size> acc, Color c, const Position& pos) {
-        const auto activateFeature = [&](u32 feature) {
+        ThreatFeatureList features{};
+        collectThreatFeatures(network, features, c, pos);
+
+#if SP_THREAT_FEATURE_PROFILE
+        nnue::features::threats::countRowReads({features.begin(), features.size()});
+#endif
+
+        for (const auto feature : features) {
             const auto* start = &network.featureTransformer().threatWeights[feature * kL1Size];
             for (i32 i = 0; i < kL1Size; ++i) {
                 acc[i] += start[i];
             }
-        };
+        }
+    }
+
+    void collectThreatFeatures(const Network& network, ThreatFeatureList& features, Color c, const Position& pos) {
+        const auto first = features.size();
 
         const auto occ = pos.occ();
 
@@ -344,10 +759,12 @@ namespace stormphrax::eval {
                 const auto attacked = pos.pieceOn(to);
                 const auto feature = nnue::features::threats::featureIndex(c, kingSq, piece, from, attacked, to);
                 if (feature < nnue::features::threats::kTotalThreatFeatures) {
-                    activateFeature(feature);
+                    features.push(feature);
                 }
             }
         }
+
+        network.featureTransformer().toThreatRows({features.begin() + first, features.size() - first});
     }
 
     namespace {
@@ -20,7 +20,11 @@
 
 #include "../types.h"
 
+#include <string>
+#include <string_view>
+
 #include "../position.h"
+#include "../util/pages.h"
 #include "arch.h"
 #include "nnue/arch/multilayer.h"
 #include "nnue/input.h"
@@ -40,11 +44,37 @@ namespace stormphrax::eval {
 
     [[nodiscard]] bool isNetworkLoaded();
 
+    // Swaps in the network in the given file, or the embedded one for "<internal>", keeping the
+    // current network on failure. Must not be called while searching, searches pick it up on start
+    bool loadNetworkFile(const std::string& path);
+
+    // Uncompressed networks are used straight out of their mapping unless huge pages are asked for
+    constexpr auto kDefaultNetworkPageMode = util::PageMode::kPlain;
+
+    // Moves the current network's weights onto the requested kind of pages, reloading
+    // it if needed. Must not be called while searching
+    void setNetworkPageMode(util::PageMode mode);
+
+    // The page mode last passed to setNetworkPageMode
+    [[nodiscard]] util::PageMode networkPageMode();
+
+    // What the current network's weights actually ended up on
+    [[nodiscard]] util::PageBacking networkPageBacking();
+
+    // Bumped whenever a network is loaded
+    [[nodiscard]] u64 networkGeneration();
+
     const Network* getNetwork(u32 numaId);
 
+    [[nodiscard]] std::string_view networkName();
+
     [[nodiscard]] std::string_view defaultNetworkName();
 
+    using ThreatFeatureList = StaticVector<u32, nnue::features::threats::kMaxActiveThreats>;
+
     void addThreatFeatures(const Network& network, std::span<i16, kL1Size> acc, Color c, const Position& pos);
+    // Appends the weight row of every active threat feature from c's perspective, in no particular order
+    void collectThreatFeatures(const Network& network, ThreatFeatureList& features, Color c, const Position& pos);
 
     template <bool kAdd>
     void updatePieceThreatsOnChange(NnueUpdates& updates, const Position& pos, Piece piece, Square sq);
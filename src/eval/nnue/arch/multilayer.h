@@ -59,6 +59,8 @@ namespace stormphrax::eval::nnue::arch {
         static constexpr bool kPairwise = true;
         static constexpr bool kRequiresFtPermute = util::simd::kPackNonSequential;
 
+        static constexpr bool kSparseL1 = true;
+
     private:
         static constexpr auto kI8ChunkSizeI32 = sizeof(i32) / sizeof(u8);
 
@@ -474,6 +476,22 @@ namespace stormphrax::eval::nnue::arch {
             outputs[0] = l3Out[0] * kScale / (kQ * kQ * kQ);
         }
 
+        // Number of nonzero four-byte chunks of activated feature transformer
+        // outputs, i.e. how many the sparse L1 matmul multiplies through
+        [[nodiscard]] inline usize activeL1Chunks(
+            std::span<const i16, kL1Size> stmPsqInputs,
+            std::span<const i16, kL1Size> nstmPsqInputs,
+            std::span<const i16, kL1Size> stmThreatInputs,
+            std::span<const i16, kL1Size> nstmThreatInputs
+        ) const {
+            sparse::SparseContext<kL1Size> sparseCtx;
+            util::simd::Array<u8, kL1Size> ftOut;
+
+            activateFt(stmPsqInputs, nstmPsqInputs, stmThreatInputs, nstmThreatInputs, ftOut, sparseCtx);
+
+            return sparseCtx.count();
+        }
+
         inline bool loadFrom(NetworkLoader& loader) {
             return loader.load(l1Weights) && loader.load(l1Biases) //
                 && loader.load(l2Weights) && loader.load(l2Biases) //
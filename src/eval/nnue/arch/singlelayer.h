@@ -46,6 +46,8 @@ namespace stormphrax::eval::nnue::arch {
         static constexpr bool kPairwise = false;
         static constexpr bool kRequiresFtPermute = false;
 
+        static constexpr bool kSparseL1 = false;
+
     private:
         static constexpr auto kOutputBucketCount = OutputBucketing::kBucketCount;
 
@@ -18,7 +18,14 @@
 
 #include "threats.h"
 
+#include <array>
 #include <utility>
+#include <vector>
+
+#if SP_THREAT_FEATURE_PROFILE
+    #include <fmt/ostream.h>
+    #include <fstream>
+#endif
 
 #include "../../../attacks/attacks.h"
 #include "../../../core.h"
@@ -132,6 +139,8 @@ namespace stormphrax::eval::nnue::features::threats {
 
             return dst;
         }();
+
+        static_assert(kTotalThreatFeatures <= 65536);
     } // namespace
 
     u32 featureIndex(Color c, Square kingSq, Piece attacker, Square attackerSq, Piece attacked, Square attackedSq) {
@@ -156,4 +165,49 @@ namespace stormphrax::eval::nnue::features::threats {
 
         return attackIdx + offset + pieceIdx;
     }
+
+    bool isValidRowOrder(std::span<const u16> order) {
+        if (order.size() != kTotalThreatFeatures) {
+            return false;
+        }
+
+        std::vector<bool> seen(kTotalThreatFeatures);
+
+        for (const auto row : order) {
+            if (row >= kTotalThreatFeatures || seen[row]) {
+                return false;
+            }
+
+            seen[row] = true;
+        }
+
+        return true;
+    }
+
+#if SP_THREAT_FEATURE_PROFILE
+    bool writeFeatureCounts(const std::string& path, std::span<const u16> rowOrder) {
+        assert(rowOrder.empty() || rowOrder.size() == kTotalThreatFeatures);
+
+        std::ofstream stream{path, std::ios::binary};
+
+        if (!stream) {
+            eprintln("Failed to open {}", path);
+            return false;
+        }
+
+        bool first = true;
+        for (u32 feature = 0; feature < kTotalThreatFeatures; ++feature) {
+            const auto row = rowOrder.empty() ? feature : rowOrder[feature];
+            if (!first) {
+                fmt::print(stream, ", ");
+            }
+            fmt::print(stream, "{}", g_rowCounts[row].load(std::memory_order::relaxed));
+            first = false;
+        }
+
+        fmt::println(stream, "");
+
+        return true;
+    }
+#endif
 } // namespace stormphrax::eval::nnue::features::threats
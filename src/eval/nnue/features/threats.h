@@ -20,10 +20,19 @@
 
 #include "../../../types.h"
 
+#include <atomic>
+#include <cassert>
 #include <span>
+#include <string>
 
 #include "psq.h"
 
+// Set to 1 (THREAT_FEATURE_PROFILE=on with make) to count how often each threat feature's weight row is read.
+// bench then writes the counts out, for preprocess/permute to store the most used rows together
+#ifndef SP_THREAT_FEATURE_PROFILE
+    #define SP_THREAT_FEATURE_PROFILE 0
+#endif
+
 namespace stormphrax::eval::nnue::features::threats {
     constexpr u32 kTotalThreatFeatures = 60144;
 
@@ -31,8 +40,61 @@ namespace stormphrax::eval::nnue::features::threats {
     constexpr usize kMaxThreatsAdded = 128;
     constexpr usize kMaxThreatsRemoved = 128;
 
-    using AddedThreatList = StaticVector<psq::UpdatedThreat, kMaxThreatsAdded>;
-    using RemovedThreatList = StaticVector<psq::UpdatedThreat, kMaxThreatsRemoved>;
+    // each of the 30 non-king pieces attacks at most 8 occupied squares
+    constexpr usize kMaxActiveThreats = 256;
+
+    // Vectorised threat generation stores a full register of threats at a time,
+    // so up to this many entries past the end of a list may be overwritten
+    constexpr usize kThreatListSlack = 16;
+
+    // One move's added or removed threats. Most moves only change a handful of threats, so rather
+    // than every accumulator stack entry holding room for the worst case, lists point into storage
+    // shared by the whole stack (see NnueState), each starting where the previous ply's ended
+    class ThreatList {
+    public:
+        ThreatList() = default;
+
+        inline ThreatList(psq::UpdatedThreat* data, usize capacity) :
+                m_data{data}, m_capacity{static_cast<u32>(capacity)} {}
+
+        inline void push(const psq::UpdatedThreat& threat) {
+            assert(m_data);
+            assert(m_size < m_capacity);
+            m_data[m_size++] = threat;
+        }
+
+        template <typename F>
+        inline void unsafeWrite(F f) {
+            assert(m_data);
+            m_size += f(m_data + m_size);
+            assert(m_size <= m_capacity);
+        }
+
+        [[nodiscard]] inline usize size() const {
+            return m_size;
+        }
+
+        [[nodiscard]] inline bool empty() const {
+            return m_size == 0;
+        }
+
+        [[nodiscard]] inline const psq::UpdatedThreat* begin() const {
+            return m_data;
+        }
+
+        [[nodiscard]] inline const psq::UpdatedThreat* end() const {
+            return m_data + m_size;
+        }
+
+        [[nodiscard]] inline psq::UpdatedThreat* end() {
+            return m_data + m_size;
+        }
+
+    private:
+        psq::UpdatedThreat* m_data{};
+        u32 m_size{};
+        u32 m_capacity{};
+    };
 
     template <typename PsqFeatureSet>
     struct ThreatInputs : PsqFeatureSet {
@@ -43,8 +105,8 @@ namespace stormphrax::eval::nnue::features::threats {
             // black, white
             std::array<bool, 2> refreshThreats{};
 
-            AddedThreatList threatsAdded{};
-            RemovedThreatList threatsRemoved{};
+            ThreatList threatsAdded{};
+            ThreatList threatsRemoved{};
 
             inline void setThreatRefresh(Color c) {
                 refreshThreats[c.idx()] = true;
@@ -74,6 +136,8 @@ namespace stormphrax::eval::nnue::features::threats {
         };
     };
 
+    // Returns the index of the given threat feature, or kTotalThreatFeatures or above if it is excluded.
+    // Networks that come with their own threat row order map this to a weight row themselves
     [[nodiscard]] u32 featureIndex(
         Color c,
         Square king,
@@ -82,4 +146,22 @@ namespace stormphrax::eval::nnue::features::threats {
         Piece attacked,
         Square attackedSq
     );
+
+    // Whether order maps every threat feature to a distinct row
+    [[nodiscard]] bool isValidRowOrder(std::span<const u16> order);
+
+#if SP_THREAT_FEATURE_PROFILE
+    // Indexed by row, not feature. Atomic, as every search thread counts into them
+    inline std::array<std::atomic<usize>, kTotalThreatFeatures> g_rowCounts{};
+
+    inline void countRowReads(std::span<const u32> rows) {
+        for (const auto row : rows) {
+            g_rowCounts[row].fetch_add(1, std::memory_order::relaxed);
+        }
+    }
+
+    // Writes the counts out by feature. rowOrder is the row each feature is
+    // stored in, as in the network the counts were gathered with, or empty
+    bool writeFeatureCounts(const std::string& path, std::span<const u16> rowOrder);
+#endif
 } // namespace stormphrax::eval::nnue::features::threats
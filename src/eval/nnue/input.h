@@ -23,6 +23,7 @@
 #include <algorithm>
 #include <array>
 #include <span>
+#include <type_traits>
 
 #include "../../core.h"
 #include "../../position.h"
@@ -191,9 +192,140 @@ namespace stormphrax::eval::nnue {
             std::ranges::copy(other.m_outputs[idx], m_outputs[idx].begin());
         }
 
+        // Sets this accumulator to src with the given threat features added and removed, reading
+        // src and writing the result once per tile. Threat weights may be narrower than the
+        // accumulator, in which case they are sign-extended in registers. src may be this accumulator
+        inline void applyThreatsFrom(
+            const Accumulator& src,
+            const Ft& featureTransformer,
+            Color c,
+            std::span<const u32> adds,
+            std::span<const u32> subs
+        ) {
+            using namespace util::simd;
+
+            using ThreatType = typename Ft::ThreatWeightType;
+
+            const auto* srcData = src.forColor(c).data();
+            auto* dstData = forColor(c).data();
+
+            const auto* weights = featureTransformer.threatWeights.data();
+
+            const auto loadRow = [](const ThreatType* ptr) {
+                if constexpr (std::is_same_v<ThreatType, Type>) {
+                    return load<Type>(ptr);
+                } else {
+                    return loadPromote<ThreatType>(ptr);
+                }
+            };
+
+            for (const auto feature : adds) {
+                assert((feature + 1) * kOutputCount <= Ft::kThreatWeightCount);
+            }
+
+            for (const auto feature : subs) {
+                assert((feature + 1) * kOutputCount <= Ft::kThreatWeightCount);
+            }
+
+#if SP_THREAT_FEATURE_PROFILE
+            features::threats::countRowReads(adds);
+            features::threats::countRowReads(subs);
+#endif
+
+            for (usize tile = 0; tile < kOutputCount; tile += kTileSize) {
+                std::array<Vector<Type>, kTileVectors> regs;
+
+                for (usize i = 0; i < kTileVectors; ++i) {
+                    regs[i] = load<Type>(&srcData[tile + i * kChunkSize<Type>]);
+                }
+
+                for (const auto feature : adds) {
+                    const auto* row = &weights[feature * kOutputCount + tile];
+                    for (usize i = 0; i < kTileVectors; ++i) {
+                        regs[i] = util::simd::add<Type>(regs[i], loadRow(&row[i * kChunkSize<Type>]));
+                    }
+                }
+
+                for (const auto feature : subs) {
+                    const auto* row = &weights[feature * kOutputCount + tile];
+                    for (usize i = 0; i < kTileVectors; ++i) {
+                        regs[i] = util::simd::sub<Type>(regs[i], loadRow(&row[i * kChunkSize<Type>]));
+                    }
+                }
+
+                for (usize i = 0; i < kTileVectors; ++i) {
+                    store<Type>(&dstData[tile + i * kChunkSize<Type>], regs[i]);
+                }
+            }
+        }
+
     private:
         SP_SIMD_ALIGNAS util::MultiArray<Type, 2, kOutputCount> m_outputs;
 
+        static constexpr usize kVectorCount = kOutputCount / util::simd::kChunkSize<Type>;
+
+        static_assert(kOutputCount % util::simd::kChunkSize<Type> == 0);
+
+        // Largest number of vectors dividing the accumulator that fits in half the
+        // register file, leaving the other half for the weight rows being applied
+        static constexpr usize kTileVectors = [] {
+            usize tile = std::min(kVectorCount, util::simd::kRegisterCount / 2);
+            while (kVectorCount % tile != 0) {
+                --tile;
+            }
+            return tile;
+        }();
+
+        static constexpr usize kTileSize = kTileVectors * util::simd::kChunkSize<Type>;
+
+        // dst = src + sum(adds) - sum(subs), one register-sized tile at a time. Each tile
+        // of the source is loaded once, stays in registers while every weight row is
+        // applied to it, and is stored once. src and dst may be the same accumulator
+        template <usize kAdds, usize kSubs>
+        SP_ALWAYS_INLINE_NDEBUG static inline void apply(
+            const Type* src,
+            Type* dst,
+            std::span<const Type, kWeightCount> delta,
+            const std::array<u32, kAdds>& addOffsets,
+            const std::array<u32, kSubs>& subOffsets
+        ) {
+            using namespace util::simd;
+
+            for (const auto offset : addOffsets) {
+                assert(offset + kOutputCount <= delta.size());
+            }
+
+            for (const auto offset : subOffsets) {
+                assert(offset + kOutputCount <= delta.size());
+            }
+
+            for (usize tile = 0; tile < kOutputCount; tile += kTileSize) {
+                std::array<Vector<Type>, kTileVectors> regs;
+
+                for (usize i = 0; i < kTileVectors; ++i) {
+                    regs[i] = load<Type>(&src[tile + i * kChunkSize<Type>]);
+                }
+
+                for (const auto offset : addOffsets) {
+                    const auto* row = &delta[offset + tile];
+                    for (usize i = 0; i < kTileVectors; ++i) {
+                        regs[i] = util::simd::add<Type>(regs[i], load<Type>(&row[i * kChunkSize<Type>]));
+                    }
+                }
+
+                for (const auto offset : subOffsets) {
+                    const auto* row = &delta[offset + tile];
+                    for (usize i = 0; i < kTileVectors; ++i) {
+                        regs[i] = util::simd::sub<Type>(regs[i], load<Type>(&row[i * kChunkSize<Type>]));
+                    }
+                }
+
+                for (usize i = 0; i < kTileVectors; ++i) {
+                    store<Type>(&dst[tile + i * kChunkSize<Type>], regs[i]);
+                }
+            }
+        }
+
         static inline void subAdd(
             std::span<const Type, kOutputCount> src,
             std::span<Type, kOutputCount> dst,
@@ -201,12 +333,7 @@ namespace stormphrax::eval::nnue {
             u32 subOffset,
             u32 addOffset
         ) {
-            assert(subOffset + kOutputCount <= delta.size());
-            assert(addOffset + kOutputCount <= delta.size());
-
-            for (u32 i = 0; i < kOutputCount; ++i) {
-                dst[i] = src[i] + delta[addOffset + i] - delta[subOffset + i];
-            }
+            apply<1, 1>(src.data(), dst.data(), delta, {addOffset}, {subOffset});
         }
 
         static inline void subSubAdd(
@@ -217,13 +344,7 @@ namespace stormphrax::eval::nnue {
             u32 subOffset1,
             u32 addOffset
         ) {
-            assert(subOffset0 + kOutputCount <= delta.size());
-            assert(subOffset1 + kOutputCount <= delta.size());
-            assert(addOffset + kOutputCount <= delta.size());
-
-            for (u32 i = 0; i < kOutputCount; ++i) {
-                dst[i] = src[i] + delta[addOffset + i] - delta[subOffset0 + i] - delta[subOffset1 + i];
-            }
+            apply<1, 2>(src.data(), dst.data(), delta, {addOffset}, {subOffset0, subOffset1});
         }
 
         static inline void subSubAddAdd(
@@ -235,15 +356,7 @@ namespace stormphrax::eval::nnue {
             u32 addOffset0,
             u32 addOffset1
         ) {
-            assert(subOffset0 + kOutputCount <= delta.size());
-            assert(subOffset1 + kOutputCount <= delta.size());
-            assert(addOffset0 + kOutputCount <= delta.size());
-            assert(addOffset1 + kOutputCount <= delta.size());
-
-            for (u32 i = 0; i < kOutputCount; ++i) {
-                dst[i] = src[i] + delta[addOffset0 + i] - delta[subOffset0 + i] + delta[addOffset1 + i]
-                       - delta[subOffset1 + i];
-            }
+            apply<2, 2>(src.data(), dst.data(), delta, {addOffset0, addOffset1}, {subOffset0, subOffset1});
         }
 
         static __attribute__((always_inline)) inline void addAddAddAdd(
@@ -254,15 +367,13 @@ namespace stormphrax::eval::nnue {
             u32 addOffset2,
             u32 addOffset3
         ) {
-            assert(addOffset0 + kOutputCount <= delta.size());
-            assert(addOffset1 + kOutputCount <= delta.size());
-            assert(addOffset2 + kOutputCount <= delta.size());
-            assert(addOffset3 + kOutputCount <= delta.size());
-
-            for (u32 i = 0; i < kOutputCount; ++i) {
-                accumulator[i] +=
-                    delta[addOffset0 + i] + delta[addOffset1 + i] + delta[addOffset2 + i] + delta[addOffset3 + i];
-            }
+            apply<4, 0>(
+                accumulator.data(),
+                accumulator.data(),
+                delta,
+                {addOffset0, addOffset1, addOffset2, addOffset3},
+                {}
+            );
         }
 
         static __attribute__((always_inline)) inline void subSubSubSub(
@@ -273,15 +384,13 @@ namespace stormphrax::eval::nnue {
             u32 subOffset2,
             u32 subOffset3
         ) {
-            assert(subOffset0 + kOutputCount <= delta.size());
-            assert(subOffset1 + kOutputCount <= delta.size());
-            assert(subOffset2 + kOutputCount <= delta.size());
-            assert(subOffset3 + kOutputCount <= delta.size());
-
-            for (u32 i = 0; i < kOutputCount; ++i) {
-                accumulator[i] -=
-                    delta[subOffset0 + i] + delta[subOffset1 + i] + delta[subOffset2 + i] + delta[subOffset3 + i];
-            }
+            apply<0, 4>(
+                accumulator.data(),
+                accumulator.data(),
+                delta,
+                {},
+                {subOffset0, subOffset1, subOffset2, subOffset3}
+            );
         }
 
         static inline void add(
@@ -289,11 +398,7 @@ namespace stormphrax::eval::nnue {
             std::span<const Type, kWeightCount> delta,
             u32 offset
         ) {
-            assert(offset + kOutputCount <= delta.size());
-
-            for (u32 i = 0; i < kOutputCount; ++i) {
-                accumulator[i] += delta[offset + i];
-            }
+            apply<1, 0>(accumulator.data(), accumulator.data(), delta, {offset}, {});
         }
 
         static inline void sub(
@@ -301,11 +406,7 @@ namespace stormphrax::eval::nnue {
             std::span<const Type, kWeightCount> delta,
             u32 offset
         ) {
-            assert(offset + kOutputCount <= delta.size());
-
-            for (u32 i = 0; i < kOutputCount; ++i) {
-                accumulator[i] -= delta[offset + i];
-            }
+            apply<0, 1>(accumulator.data(), accumulator.data(), delta, {}, {offset});
         }
     };
 
@@ -356,6 +457,18 @@ namespace stormphrax::eval::nnue {
         SP_NETWORK_PARAMS(ThreatWeightType, kThreatWeightCount, threatWeights);
         SP_NETWORK_PARAMS(OutputType, kBiasCount, biases);
 
+        // Row each threat feature's weights are stored in, null if they are in feature order
+        const u16* threatRowOrder{};
+
+        // Replaces threat features with the weight rows they are stored in
+        inline void toThreatRows(std::span<u32> features) const {
+            if (threatRowOrder) {
+                for (auto& feature : features) {
+                    feature = threatRowOrder[feature];
+                }
+            }
+        }
+
         inline bool loadFrom(NetworkLoader& loader) {
             return loader.load(psqWeights) && loader.load(threatWeights) && loader.load(biases);
         }
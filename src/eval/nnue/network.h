@@ -34,6 +34,11 @@ namespace stormphrax::eval::nnue {
             return m_featureTransformer;
         }
 
+        // order must outlive the network, or be replaced first
+        inline void setThreatRowOrder(const u16* order) {
+            m_featureTransformer.threatRowOrder = order;
+        }
+
         inline util::simd::Array<typename Arch::OutputType, Arch::kOutputCount> propagate(
             const Position& pos,
             std::span<const typename FeatureTransformer::OutputType, FeatureTransformer::kOutputCount> stmPsqInputs,
@@ -49,6 +54,17 @@ namespace stormphrax::eval::nnue {
             return outputs;
         }
 
+        [[nodiscard]] inline usize activeL1Chunks(
+            std::span<const typename FeatureTransformer::OutputType, FeatureTransformer::kOutputCount> stmPsqInputs,
+            std::span<const typename FeatureTransformer::OutputType, FeatureTransformer::kOutputCount> nstmPsqInputs,
+            std::span<const typename FeatureTransformer::OutputType, FeatureTransformer::kOutputCount> stmThreatInputs,
+            std::span<const typename FeatureTransformer::OutputType, FeatureTransformer::kOutputCount> nstmThreatInputs
+        ) const
+            requires Arch::kSparseL1
+        {
+            return m_arch.activeL1Chunks(stmPsqInputs, nstmPsqInputs, stmThreatInputs, nstmThreatInputs);
+        }
+
         inline bool loadFrom(NetworkLoader& loader, bool prePermuted) {
             if (!m_featureTransformer.loadFrom(loader) || !m_arch.loadFrom(loader)) {
                 return false;
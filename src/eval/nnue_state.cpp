@@ -18,6 +18,10 @@
 
 #include "nnue_state.h"
 
+#include <string_view>
+
+#include "../opts.h"
+#include "../util/align.h"
 #include "../util/static_vector.h"
 
 namespace stormphrax::eval {
@@ -80,20 +84,19 @@ namespace stormphrax::eval {
             curr.setPsqUpdated(c);
         }
 
-        // Updates a threat accumulator in place.
-        // Assumed to already be initialised to the previous accumulator
-        void applyThreatUpdates(const Network& network, UpdatableAccumulator& curr, const UpdateContext& ctx, Color c) {
+        // Sets curr's threat accumulator to prev's with this context's threat updates applied.
+        // prev may be curr's own threat accumulator, to update it in place
+        void applyThreatUpdates(
+            const Network& network,
+            const Accumulator& prev,
+            UpdatableAccumulator& curr,
+            const UpdateContext& ctx,
+            Color c
+        ) {
             assert(!ctx.updates.requiresThreatRefresh(c));
 
-            if (ctx.updates.threatsAdded.empty() && ctx.updates.threatsRemoved.empty()) {
-                return;
-            }
-
             const auto king = ctx.kings.color(c);
 
-            auto acc = curr.threatAcc[0].forColor(c);
-
-            usize addIndex = 0, subIndex = 0;
             StaticVector<u32, nnue::features::threats::kMaxThreatsAdded> addFeatures;
             StaticVector<u32, nnue::features::threats::kMaxThreatsAdded> subFeatures;
 
@@ -115,31 +118,21 @@ namespace stormphrax::eval {
                 subFeatures.push(feature);
             }
 
-            while (addIndex < addFeatures.size() && subIndex < subFeatures.size()) {
-                const auto addFeature = addFeatures[addIndex++];
-                const auto subFeature = subFeatures[subIndex++];
-                const auto* add = &network.featureTransformer().threatWeights[addFeature * kL1Size];
-                const auto* sub = &network.featureTransformer().threatWeights[subFeature * kL1Size];
-                for (i32 i = 0; i < kL1Size; ++i) {
-                    acc[i] += add[i];
-                    acc[i] -= sub[i];
-                }
-            }
+            network.featureTransformer().toThreatRows({addFeatures.begin(), addFeatures.size()});
+            network.featureTransformer().toThreatRows({subFeatures.begin(), subFeatures.size()});
 
-            while (addIndex < addFeatures.size()) {
-                const auto addFeature = addFeatures[addIndex++];
-                const auto* add = &network.featureTransformer().threatWeights[addFeature * kL1Size];
-                for (i32 i = 0; i < kL1Size; ++i) {
-                    acc[i] += add[i];
-                }
-            }
-
-            while (subIndex < subFeatures.size()) {
-                const auto subFeature = subFeatures[subIndex++];
-                const auto* sub = &network.featureTransformer().threatWeights[subFeature * kL1Size];
-                for (i32 i = 0; i < kL1Size; ++i) {
-                    acc[i] -= sub[i];
+            if (addFeatures.empty() && subFeatures.empty()) {
+                if (&prev != &curr.threatAcc[0]) {
+                    curr.threatAcc[0].copyFrom(c, prev);
                 }
+            } else {
+                curr.threatAcc[0].applyThreatsFrom(
+                    prev,
+                    network.featureTransformer(),
+                    c,
+                    {addFeatures.begin(), addFeatures.size()},
+                    {subFeatures.begin(), subFeatures.size()}
+                );
             }
 
             curr.setThreatUpdated(c);
@@ -189,6 +182,25 @@ namespace stormphrax::eval {
             }
         }
 
+        [[nodiscard]] usize activeL1Chunks(
+            const Network& network,
+            const Accumulator& psqAccumulator,
+            const Accumulator& threatAccumulator,
+            Color stm
+        ) {
+            if constexpr (LayeredArch::kSparseL1) {
+                return network.activeL1Chunks(
+                    psqAccumulator.forColor(stm),
+                    psqAccumulator.forColor(stm.flip()),
+                    threatAccumulator.forColor(stm),
+                    threatAccumulator.forColor(stm.flip())
+                );
+            } else {
+                SP_UNUSED(network, psqAccumulator, threatAccumulator, stm);
+                return 0;
+            }
+        }
+
         void resetPsqAccumulator(const Network& network, Accumulator& accumulator, Color c, const Position& pos) {
             assert(c != Colors::kNone);
 
@@ -276,26 +288,219 @@ namespace stormphrax::eval {
             accumulator.setPsqUpdated(c);
         }
 
+        // The difference between the threat features cached in the refresh table and the current ones
+        struct ThreatRefresh {
+            ThreatFeatureList features{};
+            ThreatFeatureList adds{};
+            ThreatFeatureList subs{};
+        };
+
+        void prepareThreatRefresh(
+            const Network& network,
+            ThreatRefresh& refresh,
+            Color c,
+            const Position& pos,
+            const ThreatRefreshTable& refreshTable
+        ) {
+            const auto& prevFeatures = refreshTable.entry(pos.king(c)).features[c.idx()];
+
+            auto& [features, adds, subs] = refresh;
+
+            collectThreatFeatures(network, features, c, pos);
+
+            std::ranges::sort(features);
+
+            // both lists are sorted, so this is a single merge pass
+            usize currIdx = 0, prevIdx = 0;
+            while (currIdx < features.size() || prevIdx < prevFeatures.size()) {
+                if (prevIdx == prevFeatures.size()
+                    || (currIdx < features.size() && features[currIdx] < prevFeatures[prevIdx]))
+                {
+                    adds.push(features[currIdx++]);
+                } else if (currIdx == features.size() || prevFeatures[prevIdx] < features[currIdx]) {
+                    subs.push(prevFeatures[prevIdx++]);
+                } else {
+                    ++currIdx;
+                    ++prevIdx;
+                }
+            }
+        }
+
+        void applyThreatRefresh(
+            const Network& network,
+            UpdatableAccumulator& accumulator,
+            Color c,
+            const Position& pos,
+            ThreatRefreshTable& refreshTable,
+            ThreatRefresh& refresh
+        ) {
+            auto& rtEntry = refreshTable.entry(pos.king(c));
+
+            if (!refresh.adds.empty() || !refresh.subs.empty()) {
+                rtEntry.accumulator.applyThreatsFrom(
+                    rtEntry.accumulator,
+                    network.featureTransformer(),
+                    c,
+                    {refresh.adds.begin(), refresh.adds.size()},
+                    {refresh.subs.begin(), refresh.subs.size()}
+                );
+            }
+
+            accumulator.threatAcc[0].copyFrom(c, rtEntry.accumulator);
+            rtEntry.features[c.idx()] = refresh.features;
+            rtEntry.bbs[c.idx()] = pos.bbs();
+
+            accumulator.setThreatUpdated(c);
+        }
+
         void refreshThreatAccumulator(
             const Network& network,
             UpdatableAccumulator& accumulator,
             Color c,
-            const Position& pos
+            const Position& pos,
+            ThreatRefreshTable& refreshTable
         ) {
             if constexpr (InputFeatureSet::kThreatInputs) {
-                resetThreatAccumulator(network, accumulator.threatAcc[0], c, pos);
-                accumulator.setThreatUpdated(c);
+                ThreatRefresh refresh{};
+                prepareThreatRefresh(network, refresh, c, pos, refreshTable);
+                applyThreatRefresh(network, accumulator, c, pos, refreshTable, refresh);
+            }
+        }
+
+        // Update costs are estimated in accumulator-row-sized passes over memory.
+        // Every incremental step also reads the previous accumulator and writes
+        // the next one, which is counted as one extra pass
+        constexpr usize kStepOverhead = 1;
+        // Enumerating and sorting every threat on the board, relative to applying one row.
+        // Tuned against the threat collection cost that evalbench reports
+        constexpr usize kThreatCollectionCost = 20;
+
+        [[nodiscard]] usize psqRefreshCost(const Position& pos, Color c, const RefreshTable& refreshTable) {
+            const auto& bbs = pos.bbs();
+
+            const auto tableIdx = InputFeatureSet::getRefreshTableEntry(c, pos.king(c));
+            const auto& prevBbs = refreshTable.table[tableIdx].bbs[c.idx()];
+
+            usize changed = 0;
+
+            for (u32 pieceIdx = 0; pieceIdx < Pieces::kNone.raw(); ++pieceIdx) {
+                const auto piece = Piece::fromRaw(pieceIdx);
+                changed += (bbs.bb(piece) ^ prevBbs.bb(piece)).popcount();
+            }
+
+            // plus copying the refreshed accumulator out of the table
+            return changed + kStepOverhead;
+        }
+
+        [[nodiscard]] usize psqReplayCost(const UpdatableAccumulator* begin, const UpdatableAccumulator* end) {
+            usize cost = 0;
+
+            for (const auto* curr = begin; curr != end; ++curr) {
+                cost += curr->ctx.updates.sub.size() + curr->ctx.updates.add.size() + kStepOverhead;
             }
+
+            return cost;
+        }
+
+        struct ThreatChain {
+            usize steps{};
+            usize threatDeltas{};
+            usize pieceDeltas{};
+
+            [[nodiscard]] inline usize replayCost() const {
+                return threatDeltas + steps * kStepOverhead;
+            }
+        };
+
+        [[nodiscard]] ThreatChain threatChain(const UpdatableAccumulator* begin, const UpdatableAccumulator* end) {
+            ThreatChain chain{};
+
+            for (const auto* curr = begin; curr != end; ++curr) {
+                ++chain.steps;
+                chain.threatDeltas += curr->ctx.updates.threatsAdded.size() + curr->ctx.updates.threatsRemoved.size();
+                chain.pieceDeltas += curr->ctx.updates.sub.size() + curr->ctx.updates.add.size();
+            }
+
+            return chain;
+        }
+
+        // The exact refresh cost is only known once every threat has been collected. This guesses it
+        // from the pieces that changed since the refresh table entry was built instead, assuming
+        // each of them changes as many threats as a piece moved along the chain being replayed
+        [[nodiscard]] usize estimateThreatRefreshCost(
+            const Position& pos,
+            Color c,
+            const ThreatRefreshTable& refreshTable,
+            const ThreatChain& chain
+        ) {
+            const auto& bbs = pos.bbs();
+            const auto& prevBbs = refreshTable.entry(pos.king(c)).bbs[c.idx()];
+
+            usize changed = 0;
+
+            for (u32 pieceIdx = 0; pieceIdx < Pieces::kNone.raw(); ++pieceIdx) {
+                const auto piece = Piece::fromRaw(pieceIdx);
+                changed += (bbs.bb(piece) ^ prevBbs.bb(piece)).popcount();
+            }
+
+            const auto threatsPerPiece = static_cast<f64>(chain.threatDeltas)
+                                       / static_cast<f64>(std::max<usize>(chain.pieceDeltas, 1));
+
+            return kThreatCollectionCost + static_cast<usize>(static_cast<f64>(changed) * threatsPerPiece)
+                 + kStepOverhead;
         }
     } // namespace
 
+    ThreatDeltaArena::ThreatDeltaArena(usize plies) :
+            m_capacity{0}, m_added{nullptr}, m_removed{nullptr} {
+        if constexpr (InputFeatureSet::kThreatInputs) {
+            using namespace nnue::features::threats;
+
+            static_assert(kMaxThreatsAdded == kMaxThreatsRemoved);
+
+            // left uninitialised rather than a vector, so pages past the deepest ply reached are never faulted in
+            m_capacity = plies * kMaxThreatsAdded + kThreatListSlack;
+
+            m_added = util::alignedAlloc<nnue::features::psq::UpdatedThreat>(kCacheLineSize, m_capacity);
+            m_removed = util::alignedAlloc<nnue::features::psq::UpdatedThreat>(kCacheLineSize, m_capacity);
+        } else {
+            SP_UNUSED(plies);
+        }
+    }
+
+    ThreatDeltaArena::~ThreatDeltaArena() {
+        util::alignedFree(m_added);
+        util::alignedFree(m_removed);
+    }
+
+    void ThreatDeltaArena::bind(UpdateContext& ctx, UpdateContext* prev) {
+        if constexpr (InputFeatureSet::kThreatInputs) {
+            using namespace nnue::features::threats;
+
+            auto* added = prev ? prev->updates.threatsAdded.end() : m_added;
+            auto* removed = prev ? prev->updates.threatsRemoved.end() : m_removed;
+
+            assert(added + kMaxThreatsAdded + kThreatListSlack <= m_added + m_capacity);
+            assert(removed + kMaxThreatsRemoved + kThreatListSlack <= m_removed + m_capacity);
+
+            ctx.updates.threatsAdded = ThreatList{added, kMaxThreatsAdded};
+            ctx.updates.threatsRemoved = ThreatList{removed, kMaxThreatsRemoved};
+        } else {
+            SP_UNUSED(ctx, prev);
+        }
+    }
+
     void NnueState::reset(const Position& pos) {
         assert(m_network);
 
         m_refreshTable.init(m_network->featureTransformer());
+        m_threatRefreshTable.clear();
 
         m_top = &m_accumulatorStack[0];
 
+        m_top->ctx = {};
+        m_threatDeltas.bind(m_top->ctx, nullptr);
+
         for (const auto c : {Colors::kBlack, Colors::kWhite}) {
             const auto king = pos.king(c);
             const auto entry = InputFeatureSet::getRefreshTableEntry(c, king);
@@ -307,7 +512,8 @@ namespace stormphrax::eval {
             rtEntry.colorBbs(c) = pos.bbs();
 
             if constexpr (InputFeatureSet::kThreatInputs) {
-                resetThreatAccumulator(*m_network, m_top->threatAcc[0], c, pos);
+                // goes through the (just cleared) refresh table to seed it
+                refreshThreatAccumulator(*m_network, *m_top, c, pos, m_threatRefreshTable);
             }
         }
     }
@@ -316,28 +522,45 @@ namespace stormphrax::eval {
         ++m_top;
 
         m_top->ctx = {};
+        m_threatDeltas.bind(m_top->ctx, &(m_top - 1)->ctx);
+
         m_top->setPsqDirty();
         m_top->setThreatDirty();
 
         return BoardObserver{m_top->ctx};
     }
 
+    UpdateContext& NnueState::immediateContext() {
+        m_immediateCtx = {};
+        m_threatDeltas.bind(m_immediateCtx, &m_top->ctx);
+
+        return m_immediateCtx;
+    }
+
     void NnueState::applyImmediately(const UpdateContext& ctx, const Position& pos) {
         assert(m_network);
         for (const auto c : {Colors::kBlack, Colors::kWhite}) {
             assert(pos.king(c) == ctx.kings.color(c));
 
             if (ctx.updates.requiresPsqRefresh(c)) {
-                refreshPsqAccumulator(*m_network, *m_top, c, pos, m_refreshTable);
+                profiled(ProfiledWork::kPsqRefresh, [&] {
+                    refreshPsqAccumulator(*m_network, *m_top, c, pos, m_refreshTable);
+                });
             } else {
-                updatePsq(*m_network, m_top->psqAcc, *m_top, ctx, c);
+                profiled(ProfiledWork::kPsqUpdate, [&] {
+                    updatePsq(*m_network, m_top->psqAcc, *m_top, ctx, c);
+                });
             }
 
             if constexpr (InputFeatureSet::kThreatInputs) {
                 if (ctx.updates.requiresThreatRefresh(c)) {
-                    refreshThreatAccumulator(*m_network, *m_top, c, pos);
+                    profiled(ProfiledWork::kThreatRefresh, [&] {
+                        refreshThreatAccumulator(*m_network, *m_top, c, pos, m_threatRefreshTable);
+                    });
                 } else {
-                    applyThreatUpdates(*m_network, *m_top, ctx, c);
+                    profiled(ProfiledWork::kThreatUpdate, [&] {
+                        applyThreatUpdates(*m_network, m_top->threatAcc[0], *m_top, ctx, c);
+                    });
                 }
             }
         }
@@ -355,11 +578,40 @@ namespace stormphrax::eval {
 
         ensureUpToDate(pos);
 
-        if constexpr (InputFeatureSet::kThreatInputs) {
-            return evaluateNetwork(*m_network, m_top->psqAcc, &m_top->threatAcc[0], pos, stm);
-        } else {
-            return evaluateNetwork(*m_network, m_top->psqAcc, nullptr, pos, stm);
+        // outside of the timed propagation, as this repeats part of it
+        if (m_profile) {
+            if constexpr (InputFeatureSet::kThreatInputs) {
+                m_profile->activeL1Chunks += activeL1Chunks(*m_network, m_top->psqAcc, m_top->threatAcc[0], stm);
+            } else {
+                m_profile->activeL1Chunks += activeL1Chunks(*m_network, m_top->psqAcc, m_top->psqAcc, stm);
+            }
         }
+
+        return profiled(ProfiledWork::kPropagate, [&] {
+            if constexpr (InputFeatureSet::kThreatInputs) {
+                return evaluateNetwork(*m_network, m_top->psqAcc, &m_top->threatAcc[0], pos, stm);
+            } else {
+                return evaluateNetwork(*m_network, m_top->psqAcc, nullptr, pos, stm);
+            }
+        });
+    }
+
+    i32 NnueState::evaluateCached(const Position& pos) {
+        if (!g_opts.evalCache) {
+            return evaluate(pos, pos.stm());
+        }
+
+        ++m_evalCacheStats.probes;
+
+        if (i32 eval; m_evalCache.probe(pos.key(), eval)) {
+            ++m_evalCacheStats.hits;
+            return eval;
+        }
+
+        const auto eval = evaluate(pos, pos.stm());
+        m_evalCache.store(pos.key(), eval);
+
+        return eval;
     }
 
     i32 NnueState::evaluateOnce(const Position& pos, Color stm) {
@@ -394,9 +646,16 @@ namespace stormphrax::eval {
                 continue;
             }
 
+            const auto refresh = [&] {
+                profiled(ProfiledWork::kPsqRefresh, [&] {
+                    refreshPsqAccumulator(*m_network, *m_top, c, pos, m_refreshTable);
+                });
+            };
+
             // if the current accumulator needs a refresh, just do it
             if (m_top->ctx.updates.requiresPsqRefresh(c)) {
-                refreshPsqAccumulator(*m_network, *m_top, c, pos, m_refreshTable);
+                refresh();
+                ++m_updateStats.psqForcedRefreshes;
                 continue;
             }
 
@@ -409,13 +668,22 @@ namespace stormphrax::eval {
 
             // if the found accumulator requires a refresh, just give up and refresh the current one
             if (curr->ctx.updates.requiresPsqRefresh(c)) {
-                refreshPsqAccumulator(*m_network, *m_top, c, pos, m_refreshTable);
+                refresh();
+                ++m_updateStats.psqForcedRefreshes;
+            } else if (psqRefreshCost(pos, c, m_refreshTable) < psqReplayCost(curr + 1, m_top + 1)) {
+                // a long chain can cost more to replay than catching up the refresh table entry
+                refresh();
+                ++m_updateStats.psqRefreshes;
             } else {
                 // otherwise go forward and incrementally update all accumulators in between
                 do {
                     const auto& prev = *curr++;
-                    updatePsq(*m_network, prev.psqAcc, *curr, curr->ctx, c);
+                    profiled(ProfiledWork::kPsqUpdate, [&] {
+                        updatePsq(*m_network, prev.psqAcc, *curr, curr->ctx, c);
+                    });
                 } while (curr != m_top);
+
+                ++m_updateStats.psqReplays;
             }
         }
 
@@ -426,8 +694,15 @@ namespace stormphrax::eval {
                     continue;
                 }
 
+                const auto refresh = [&] {
+                    profiled(ProfiledWork::kThreatRefresh, [&] {
+                        refreshThreatAccumulator(*m_network, *m_top, c, pos, m_threatRefreshTable);
+                    });
+                };
+
                 if (m_top->ctx.updates.requiresThreatRefresh(c)) {
-                    refreshThreatAccumulator(*m_network, *m_top, c, pos);
+                    refresh();
+                    ++m_updateStats.threatForcedRefreshes;
                     continue;
                 }
 
@@ -437,15 +712,76 @@ namespace stormphrax::eval {
                 assert(curr != &m_accumulatorStack[0] || !curr->ctx.updates.requiresThreatRefresh(c));
 
                 if (curr->ctx.updates.requiresThreatRefresh(c)) {
-                    refreshThreatAccumulator(*m_network, *m_top, c, pos);
-                } else {
-                    do {
-                        const auto& prev = *curr++;
-                        curr->threatAcc[0].copyFrom(c, prev.threatAcc[0]);
-                        applyThreatUpdates(*m_network, *curr, curr->ctx, c);
-                    } while (curr != m_top);
+                    refresh();
+                    ++m_updateStats.threatForcedRefreshes;
+                    continue;
                 }
+
+                const auto chain = threatChain(curr + 1, m_top + 1);
+                const auto replayCost = chain.replayCost();
+
+                // collecting the threats is too expensive to do just to find out that the refresh
+                // loses, which it does for most short chains, so only try when it's likely to win
+                if (estimateThreatRefreshCost(pos, c, m_threatRefreshTable, chain) < replayCost) {
+                    const auto tryRefresh = [&] {
+                        ThreatRefresh refresh{};
+                        prepareThreatRefresh(*m_network, refresh, c, pos, m_threatRefreshTable);
+
+                        const auto refreshCost =
+                            kThreatCollectionCost + refresh.adds.size() + refresh.subs.size() + kStepOverhead;
+
+                        if (refreshCost >= replayCost) {
+                            return false;
+                        }
+
+                        applyThreatRefresh(*m_network, *m_top, c, pos, m_threatRefreshTable, refresh);
+                        return true;
+                    };
+
+                    const bool refreshed =
+                        profiledIf(ProfiledWork::kThreatRefresh, ProfiledWork::kThreatRefreshAttempt, tryRefresh);
+
+                    if (refreshed) {
+                        ++m_updateStats.threatRefreshes;
+                        continue;
+                    }
+                }
+
+                do {
+                    const auto& prev = *curr++;
+                    profiled(ProfiledWork::kThreatUpdate, [&] {
+                        applyThreatUpdates(*m_network, prev.threatAcc[0], *curr, curr->ctx, c);
+                    });
+                } while (curr != m_top);
+
+                ++m_updateStats.threatReplays;
             }
         }
     }
+
+    void AccumulatorUpdateStats::print() const {
+        const auto printPaths = [](std::string_view name, usize replays, usize refreshes, usize forced) {
+            const auto total = replays + refreshes + forced;
+            const auto percent = [&](usize n) {
+                return total == 0 ? 0.0 : static_cast<f64>(n) * 100.0 / static_cast<f64>(total);
+            };
+
+            println(
+                "{} updates: {} replayed ({:.2f}%), {} refreshed ({:.2f}%), {} forced refreshes ({:.2f}%)",
+                name,
+                replays,
+                percent(replays),
+                refreshes,
+                percent(refreshes),
+                forced,
+                percent(forced)
+            );
+        };
+
+        printPaths("psq", psqReplays, psqRefreshes, psqForcedRefreshes);
+
+        if constexpr (InputFeatureSet::kThreatInputs) {
+            printPaths("threat", threatReplays, threatRefreshes, threatForcedRefreshes);
+        }
+    }
 } // namespace stormphrax::eval
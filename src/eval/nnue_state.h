@@ -20,8 +20,12 @@
 
 #include "../types.h"
 
+#include <algorithm>
+#include <array>
+#include <type_traits>
 #include <vector>
 
+#include "../util/timer.h"
 #include "nnue.h"
 
 namespace stormphrax::eval {
@@ -82,15 +86,171 @@ namespace stormphrax::eval {
         }
     };
 
+    // Last threat accumulator built for each king side, along with the sorted threat
+    // features it holds for each perspective and the board they were collected from.
+    // Threat features only depend on which side of the board the king is on, so a
+    // refresh only has to apply the difference
+    struct ThreatRefreshTable {
+        struct Entry {
+            Accumulator accumulator{};
+            std::array<ThreatFeatureList, 2> features{};
+            std::array<BitboardSet, 2> bbs{};
+        };
+
+        // a-d, e-h
+        std::array<Entry, 2> table{};
+
+        inline void clear() {
+            for (auto& entry : table) {
+                entry.accumulator.clear(Colors::kBlack);
+                entry.accumulator.clear(Colors::kWhite);
+
+                for (auto& features : entry.features) {
+                    features.clear();
+                }
+
+                entry.bbs.fill(BitboardSet{});
+            }
+        }
+
+        [[nodiscard]] inline Entry& entry(Square king) {
+            return table[king.file() >= kFileE];
+        }
+
+        [[nodiscard]] inline const Entry& entry(Square king) const {
+            return table[king.file() >= kFileE];
+        }
+    };
+
+    // How stale accumulators were brought up to date. Forced refreshes are the
+    // ones where the chain of dirty accumulators crossed a required refresh
+    struct AccumulatorUpdateStats {
+        usize psqReplays{};
+        usize psqRefreshes{};
+        usize psqForcedRefreshes{};
+
+        usize threatReplays{};
+        usize threatRefreshes{};
+        usize threatForcedRefreshes{};
+
+        void print() const;
+    };
+
+    enum class ProfiledWork : u8 {
+        kPsqUpdate = 0,
+        kThreatUpdate,
+        kPsqRefresh,
+        kThreatRefresh,
+        kThreatRefreshAttempt,
+        kPropagate,
+        kCount,
+    };
+
+    // Time spent on each step of accumulator work and on propagation, only gathered while a
+    // profile is attached to an NnueState. Threat refreshes include collecting the active threats.
+    // Collections that the cost model then decided against are counted as refresh attempts
+    struct UpdateProfile {
+        std::array<f64, static_cast<usize>(ProfiledWork::kCount)> seconds{};
+        std::array<usize, static_cast<usize>(ProfiledWork::kCount)> counts{};
+
+        // summed over every profiled propagation, for sparse L1 archs
+        usize activeL1Chunks{};
+
+        [[nodiscard]] inline f64 nsPer(ProfiledWork work) const {
+            const auto idx = static_cast<usize>(work);
+            return counts[idx] == 0 ? 0.0 : seconds[idx] * 1e9 / static_cast<f64>(counts[idx]);
+        }
+    };
+
+    struct EvalCacheStats {
+        usize probes{};
+        usize hits{};
+    };
+
+    // Direct-mapped cache of raw network outputs, keyed on the full position key.
+    // Contempt, optimism and correction are all applied on top of the raw output,
+    // so they don't need to be part of the key
+    class EvalCache {
+    public:
+        // 128 KiB, small enough to mostly stay in L2
+        static constexpr usize kEntries = 8192;
+
+        EvalCache() :
+                m_entries(kEntries) {}
+
+        [[nodiscard]] inline bool probe(u64 key, i32& eval) const {
+            const auto& entry = m_entries[key % kEntries];
+
+            if (entry.key != key) {
+                return false;
+            }
+
+            eval = entry.eval;
+            return true;
+        }
+
+        inline void store(u64 key, i32 eval) {
+            m_entries[key % kEntries] = {key, eval};
+        }
+
+        inline void clear() {
+            std::ranges::fill(m_entries, Entry{});
+        }
+
+    private:
+        struct Entry {
+            u64 key{};
+            i32 eval{};
+        };
+
+        std::vector<Entry> m_entries;
+    };
+
+    // Backing storage for the threat lists of every context in an accumulator stack, packed back to back.
+    // Sized for the worst case, but only the parts actually reached are ever touched, so the hot part
+    // of the stack stays a few cache lines of threats per ply rather than two full lists
+    class ThreatDeltaArena {
+    public:
+        explicit ThreatDeltaArena(usize plies);
+        ~ThreatDeltaArena();
+
+        ThreatDeltaArena(const ThreatDeltaArena&) = delete;
+        ThreatDeltaArena(ThreatDeltaArena&&) = delete;
+
+        // Points ctx's threat lists at the space just past prev's, or at the start of the arena
+        void bind(UpdateContext& ctx, UpdateContext* prev);
+
+        ThreatDeltaArena& operator=(const ThreatDeltaArena&) = delete;
+        ThreatDeltaArena& operator=(ThreatDeltaArena&&) = delete;
+
+    private:
+        usize m_capacity;
+
+        nnue::features::psq::UpdatedThreat* m_added;
+        nnue::features::psq::UpdatedThreat* m_removed;
+    };
+
     class NnueState {
     public:
-        NnueState() {
-            m_accumulatorStack.resize(256);
+        static constexpr usize kStackSize = 256;
+
+        NnueState() :
+                m_threatDeltas{kStackSize + 1} {
+            m_accumulatorStack.resize(kStackSize);
         }
 
         inline void setNetwork(const Network* network) {
             assert(network);
+
+            // cached outputs are only valid for the network that produced them
+            const auto generation = networkGeneration();
+
+            if (network != m_network || generation != m_networkGeneration) {
+                m_evalCache.clear();
+            }
+
             m_network = network;
+            m_networkGeneration = generation;
         }
 
         void reset(const Position& pos);
@@ -98,21 +258,101 @@ namespace stormphrax::eval {
         [[nodiscard]] BoardObserver push();
         void pop();
 
+        // Empty context for a move to be applied with applyImmediately rather than pushed
+        [[nodiscard]] UpdateContext& immediateContext();
+
         void applyImmediately(const UpdateContext& ctx, const Position& pos);
 
         [[nodiscard]] i32 evaluate(const Position& pos, Color stm);
 
+        // Evaluates from the side to move's perspective, going through the eval cache if enabled
+        [[nodiscard]] i32 evaluateCached(const Position& pos);
+
+        [[nodiscard]] inline const EvalCacheStats& evalCacheStats() const {
+            return m_evalCacheStats;
+        }
+
+        inline void resetEvalCacheStats() {
+            m_evalCacheStats = {};
+        }
+
+        [[nodiscard]] inline const AccumulatorUpdateStats& updateStats() const {
+            return m_updateStats;
+        }
+
+        inline void resetUpdateStats() {
+            m_updateStats = {};
+        }
+
+        // Times all accumulator work and propagation into profile until detached with nullptr
+        inline void setProfile(UpdateProfile* profile) {
+            m_profile = profile;
+        }
+
         [[nodiscard]] static i32 evaluateOnce(const Position& pos, Color stm);
 
     private:
         std::vector<UpdatableAccumulator> m_accumulatorStack{};
         UpdatableAccumulator* m_top{};
 
+        // one more ply than the stack, for immediateContext()
+        ThreatDeltaArena m_threatDeltas;
+        UpdateContext m_immediateCtx{};
+
         RefreshTable m_refreshTable{};
+        ThreatRefreshTable m_threatRefreshTable{};
 
         const Network* m_network{};
+        u64 m_networkGeneration{};
+
+        EvalCache m_evalCache{};
+        EvalCacheStats m_evalCacheStats{};
+
+        AccumulatorUpdateStats m_updateStats{};
+
+        UpdateProfile* m_profile{};
 
         void ensureUpToDate(const Position& pos);
+
+        template <typename F>
+        inline decltype(auto) profiled(ProfiledWork work, const F& f) {
+            if (!m_profile) [[likely]] {
+                return f();
+            }
+
+            const auto idx = static_cast<usize>(work);
+            const auto start = util::Instant::now();
+
+            ++m_profile->counts[idx];
+
+            if constexpr (std::is_void_v<decltype(f())>) {
+                f();
+                m_profile->seconds[idx] += start.elapsed();
+            } else {
+                decltype(auto) result = f();
+                m_profile->seconds[idx] += start.elapsed();
+                return result;
+            }
+        }
+
+        // Like profiled, but counts the work as abandoned instead if f reports not having done it
+        template <typename F>
+        inline bool profiledIf(ProfiledWork work, ProfiledWork abandoned, const F& f) {
+            if (!m_profile) [[likely]] {
+                return f();
+            }
+
+            const auto start = util::Instant::now();
+
+            const bool done = f();
+
+            const auto idx = static_cast<usize>(done ? work : abandoned);
+
+            m_profile->seconds[idx] += start.elapsed();
+            ++m_profile->counts[idx];
+
+            return done;
+        }
     };
 
     inline void BoardObserver::prepareKingMove(Color c, Square src, Square dst) {
@@ -155,6 +155,10 @@ namespace stormphrax::limit {
         return true;
     }
 
+    void SearchLimiter::restart(util::Instant startTime) {
+        m_startTime = startTime;
+    }
+
     void SearchLimiter::update(i32 depth, usize totalNodes, const search::RootMove& pvMove) {
         if (m_timeManager) {
             m_timeManager->update(depth, totalNodes, pvMove);
@@ -70,6 +70,9 @@ namespace stormphrax::limit {
 
         bool setTournamentTime(const TimeLimits& limits, u32 moveOverheadMs);
 
+        // Counts time limits from startTime instead, for ponderhits
+        void restart(util::Instant startTime);
+
         void update(i32 depth, usize totalNodes, const search::RootMove& pvMove);
 
         [[nodiscard]] bool stopSoft(usize nodes) const;
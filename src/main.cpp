@@ -19,6 +19,7 @@
 #include "bench.h"
 #include "cuckoo.h"
 #include "datagen/datagen.h"
+#include "eval/evalbench.h"
 #include "eval/nnue.h"
 #include "tunable.h"
 #include "uci.h"
@@ -39,6 +40,24 @@ namespace {
             if (mode == "bench") {
                 bench::run();
                 return 0;
+            } else if (mode == "ttbench") {
+                bench::runTt();
+                return 0;
+            } else if (mode == "evalcachebench") {
+                bench::runEvalCache();
+                return 0;
+            } else if (mode == "evalpagesbench") {
+                bench::runEvalPages();
+                return 0;
+            } else if (mode == "latencybench") {
+                bench::runLatency();
+                return 0;
+            } else if (mode == "scalingbench") {
+                bench::runScaling();
+                return 0;
+            } else if (mode == "evalbench") {
+                eval::evalbench::run();
+                return 0;
             } else if (mode == "datagen") {
                 const auto printUsage = [&]() {
                     eprintln(
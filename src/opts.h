@@ -53,8 +53,14 @@ namespace stormphrax {
 
             bool enableWeirdTcs{false};
 
+            bool ponder{false};
+
             bool minimal{false};
 
+            bool ttStats{false};
+
+            bool evalCache{true};
+
             bool syzygyEnabled{false};
             i32 syzygyProbeDepth{1};
             i32 syzygyProbeLimit{7};
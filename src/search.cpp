@@ -72,8 +72,9 @@ namespace stormphrax::search {
     }
 
     void Searcher::newGame() {
-        // Finalisation (init) clears the TT, so don't clear it twice
-        if (!m_ttable.finalize()) {
+        // Finalisation (init) clears the TT, so don't clear it twice.
+        // Also keep a restored snapshot around until it has actually been searched with
+        if (!m_ttable.finalize() && !m_ttable.restored()) {
             m_ttable.clear();
         }
 
@@ -84,10 +85,54 @@ namespace stormphrax::search {
         for (auto& thread : m_threadData) {
             thread->history.clear();
         }
+
+        resetTtStats();
     }
 
     void Searcher::ensureReady() {
         m_ttable.finalize();
+
+        // the GUI explicitly asked, so don't claim to be ready while still clearing
+        m_ttable.waitForClear();
+    }
+
+    std::optional<TtStats> Searcher::ttStats() const {
+        std::optional<TtStats> total{};
+
+        for (const auto& thread : m_threadData) {
+            if (thread->ttStats) {
+                if (!total) {
+                    total = TtStats{};
+                }
+
+                *total += *thread->ttStats;
+            }
+        }
+
+        return total;
+    }
+
+    void Searcher::resetTtStats() {
+        for (auto& thread : m_threadData) {
+            if (thread->ttStats) {
+                *thread->ttStats = TtStats{};
+            }
+        }
+    }
+
+    TtOccupancy Searcher::ttOccupancy() {
+        m_ttable.finalize();
+        return m_ttable.occupancy();
+    }
+
+    bool Searcher::saveTtSnapshot(std::string_view path) {
+        m_ttable.finalize();
+        return m_ttable.save(path);
+    }
+
+    bool Searcher::loadTtSnapshot(std::string_view path) {
+        m_ttable.finalize();
+        return m_ttable.load(path);
     }
 
     void Searcher::startSearch(
@@ -95,7 +140,8 @@ namespace stormphrax::search {
         std::span<const u64> keyHistory,
         Instant startTime,
         std::span<Move> moves,
-        bool infinite
+        bool infinite,
+        bool ponder
     ) {
         if (!m_limiter) {
             eprintln("missing limiter");
@@ -157,15 +203,38 @@ namespace stormphrax::search {
         m_startTime = startTime;
 
         m_stop.store(false, std::memory_order::seq_cst);
+        m_stopRequested = false;
         m_runningThreads.store(static_cast<i32>(m_threads.size()));
+        m_startedThreads.store(0, std::memory_order::relaxed);
 
+        m_pondering.store(ponder, std::memory_order::release);
+        m_resizing.store(false, std::memory_order::relaxed);
         m_searching.store(true, std::memory_order::relaxed);
 
         m_idleBarrier.arriveAndWait();
         m_setupBarrier.arriveAndWait();
     }
 
+    void Searcher::ponderhit(Instant startTime) {
+        // the main thread only looks at the limiter's start time once it sees this store
+        m_limiter->restart(startTime);
+
+        const std::unique_lock lock{m_stopMutex};
+
+        m_pondering.store(false, std::memory_order::release);
+        m_releaseSignal.notify_one();
+    }
+
     void Searcher::stop() {
+        {
+            const std::unique_lock lock{m_stopMutex};
+
+            m_stopRequested = true;
+            m_pondering.store(false, std::memory_order::release);
+
+            m_releaseSignal.notify_one();
+        }
+
         m_stop.store(true, std::memory_order::relaxed);
         waitForStop();
     }
@@ -205,6 +274,8 @@ namespace stormphrax::search {
     std::pair<Score, Score> Searcher::runDatagenSearch() {
         auto& thread = *m_threadData[0];
 
+        m_ttable.waitForClear();
+
         if (initRootMoveList(thread.rootPos) == RootStatus::kNoLegalMoves) {
             return {-kScoreMate, -kScoreMate};
         }
@@ -224,6 +295,9 @@ namespace stormphrax::search {
     void Searcher::runBenchSearch(BenchData& data) {
         auto& thread = *m_threadData[0];
 
+        // bench node counts must not depend on how far a background clear got
+        m_ttable.waitForClear();
+
         if (initRootMoveList(thread.rootPos) == RootStatus::kNoLegalMoves) {
             println("no legal moves");
             return;
@@ -236,6 +310,7 @@ namespace stormphrax::search {
         m_minRootScore = -kScoreInf;
         m_maxRootScore = kScoreInf;
 
+        thread.nnueState.setNetwork(eval::getNetwork(thread.numaId));
         thread.nnueState.reset(thread.rootPos);
 
         m_runningThreads.store(1);
@@ -249,36 +324,69 @@ namespace stormphrax::search {
         data.nodes = thread.search.loadNodes();
     }
 
+    std::vector<usize> Searcher::threadNodes() const {
+        std::vector<usize> nodes{};
+        nodes.reserve(m_threadData.size());
+
+        for (const auto& thread : m_threadData) {
+            nodes.push_back(thread->search.loadNodes());
+        }
+
+        return nodes;
+    }
+
     void Searcher::setThreads(u32 threadCount) {
-        if (threadCount == m_threads.size()) {
+        const auto prevThreadCount = static_cast<u32>(m_threads.size());
+
+        if (threadCount == prevThreadCount) {
             return;
         }
 
-        stopThreads();
+        m_threadCount.store(threadCount, std::memory_order::relaxed);
 
-        m_quit.store(false, std::memory_order::seq_cst);
+        if (prevThreadCount > 0) {
+            // Take the existing threads once around their idle loop without searching. Threads
+            // beyond the new count exit, and the rest keep their data and go back to waiting.
+            // Nobody can arrive at the reset barrier again until this thread arrives at the
+            // idle barrier, so it can be resized in between
+            m_resizing.store(true, std::memory_order::relaxed);
 
-        m_threads.clear();
-        m_threads.shrink_to_fit();
-        m_threads.reserve(threadCount);
-
-        m_threadData.clear();
-        m_threadData.resize(threadCount);
-        m_threadData.shrink_to_fit();
+            m_resetBarrier.arriveAndWait();
+            m_resetBarrier.reset(threadCount + 1);
 
-        m_initBarrier.reset(threadCount + 1);
+            m_idleBarrier.arriveAndWait();
+        } else {
+            // all threads were stopped by take()
+            m_quit.store(false, std::memory_order::seq_cst);
+            m_resetBarrier.reset(threadCount + 1);
+        }
 
-        m_resetBarrier.reset(threadCount + 1);
         m_idleBarrier.reset(threadCount + 1);
         m_setupBarrier.reset(threadCount + 1);
 
         m_searchEndBarrier.reset(threadCount);
 
-        for (u32 threadId = 0; threadId < threadCount; ++threadId) {
-            m_threads.emplace_back([this, threadId] { run(threadId); });
+        for (u32 threadId = threadCount; threadId < prevThreadCount; ++threadId) {
+            m_threads[threadId].join();
         }
 
-        m_initBarrier.arriveAndWait();
+        if (threadCount < prevThreadCount) {
+            m_threads.resize(threadCount);
+        }
+
+        m_threadData.resize(threadCount);
+
+        if (threadCount > prevThreadCount) {
+            m_threads.reserve(threadCount);
+
+            m_initBarrier.reset(threadCount - prevThreadCount + 1);
+
+            for (u32 threadId = prevThreadCount; threadId < threadCount; ++threadId) {
+                m_threads.emplace_back([this, threadId] { run(threadId); });
+            }
+
+            m_initBarrier.arriveAndWait();
+        }
     }
 
     RootStatus Searcher::initRootMoveList(const Position& pos) {
@@ -351,10 +459,16 @@ namespace stormphrax::search {
             m_resetBarrier.arriveAndWait();
             m_idleBarrier.arriveAndWait();
 
-            if (m_quit.load(std::memory_order::acquire)) {
+            if (m_quit.load(std::memory_order::acquire)
+                || threadId >= m_threadCount.load(std::memory_order::relaxed))
+            {
                 return;
             }
 
+            if (m_resizing.load(std::memory_order::relaxed)) {
+                continue;
+            }
+
             searchRoot(thread, true);
         }
     }
@@ -369,9 +483,13 @@ namespace stormphrax::search {
 
             std::ranges::copy(m_setupInfo.keyHistory, std::back_inserter(thread.keyHistory));
 
+            // picks up a network swapped in since the last search
+            thread.nnueState.setNetwork(eval::getNetwork(thread.numaId));
             thread.nnueState.reset(thread.rootPos);
 
             m_setupBarrier.arriveAndWait();
+
+            m_startedThreads.fetch_add(1, std::memory_order::release);
         }
 
         assert(!m_rootMoveList.empty());
@@ -386,6 +504,12 @@ namespace stormphrax::search {
             rootMove.pv.length = 1;
         }
 
+        if (!g_opts.ttStats) {
+            thread.ttStats.reset();
+        } else if (!thread.ttStats) {
+            thread.ttStats = std::make_unique<TtStats>();
+        }
+
         auto& searchData = thread.search;
 
         PvList rootPv{};
@@ -396,6 +520,10 @@ namespace stormphrax::search {
 
         thread.depthCompleted = 0;
 
+        if (thread.isMainThread()) {
+            m_depthTimes.clear();
+        }
+
         for (i32 depth = 1;; ++depth) {
             searchData.rootDepth = depth;
 
@@ -471,9 +599,11 @@ namespace stormphrax::search {
                     const bool lastPv = thread.pvIdx + 1 == m_multiPv;
 
                     if (lastPv && !hasStopped()) {
+                        m_depthTimes.push_back(elapsed());
+
                         const auto nodes = searchData.loadNodes();
                         m_limiter->update(depth, nodes, thread.pvMove());
-                        if (depth >= m_maxDepth || m_limiter->stopSoft(nodes)) {
+                        if (depth >= m_maxDepth || (!pondering() && m_limiter->stopSoft(nodes))) {
                             m_stop.store(true, std::memory_order::relaxed);
                         }
                     }
@@ -498,9 +628,10 @@ namespace stormphrax::search {
         }
 
         const auto waitForThreads = [&] {
-            {
+            // only the last thread out needs the lock, so that
+            // the wakeup can't slip in between stop()'s check and wait
+            if (m_runningThreads.fetch_sub(1, std::memory_order::seq_cst) == 1) {
                 const std::unique_lock lock{m_stopMutex};
-                --m_runningThreads;
                 m_stopSignal.notify_all();
             }
 
@@ -508,10 +639,21 @@ namespace stormphrax::search {
         };
 
         if (thread.isMainThread()) {
-            if (m_infinite) {
-                // don't print bestmove until stopped when go infinite'ing
-                while (!hasStopped()) {
-                    std::this_thread::yield();
+            // don't print bestmove until stopped when go infinite'ing, or until ponderhit when pondering,
+            //   even if the search has already run out of depth
+            if (m_infinite || pondering()) {
+                std::unique_lock lock{m_stopMutex};
+
+                const auto holdingBestmove = [this] {
+                    return (m_infinite && !m_stopRequested) || pondering();
+                };
+
+                if (holdingBestmove()) {
+                    if (!m_silent) {
+                        println("info string search complete, waiting for {}", pondering() ? "ponderhit" : "stop");
+                    }
+
+                    m_releaseSignal.wait(lock, [&] { return !holdingBestmove(); });
                 }
             }
 
@@ -549,7 +691,7 @@ namespace stormphrax::search {
         assert(kRootNode || ply > 0);
         assert(kPvNode || alpha + 1 == beta);
 
-        if (!kRootNode && thread.isMainThread() && thread.search.rootDepth > 1) {
+        if (!kRootNode && thread.isMainThread() && thread.search.rootDepth > 1 && !pondering()) {
             if (m_limiter->stopHard(thread.search.loadNodes())) {
                 m_stop.store(true, std::memory_order::relaxed);
                 return 0;
@@ -613,7 +755,7 @@ namespace stormphrax::search {
         bool ttHit = false;
 
         if (!curr.excluded) {
-            ttHit = m_ttable.probe(ttEntry, pos.key(), ply);
+            ttHit = m_ttable.probe(ttEntry, pos.key(), ply, thread.ttStats.get());
 
             if (!kPvNode && ttEntry.depth >= depth && (ttEntry.score <= alpha || cutnode)
                 && (ttEntry.flag == TtFlag::kExact                                     //
@@ -683,7 +825,17 @@ namespace stormphrax::search {
                     || (flag == TtFlag::kUpperBound && score <= alpha) //
                     || (flag == TtFlag::kLowerBound && score >= beta))
                 {
-                    m_ttable.put(pos.key(), score, kScoreNone, kNullMove, depth, ply, flag, curr.ttpv);
+                    m_ttable.put(
+                        pos.key(),
+                        score,
+                        kScoreNone,
+                        kNullMove,
+                        depth,
+                        ply,
+                        flag,
+                        curr.ttpv,
+                        thread.ttStats.get()
+                    );
                     return score;
                 }
 
@@ -717,7 +869,7 @@ namespace stormphrax::search {
             }
 
             if (!ttHit) {
-                m_ttable.putStaticEval(pos.key(), rawStaticEval, curr.ttpv);
+                m_ttable.putStaticEval(pos.key(), rawStaticEval, curr.ttpv, thread.ttStats.get());
             }
 
             if (inCheck) {
@@ -1356,7 +1508,17 @@ namespace stormphrax::search {
             }
 
             if (!kRootNode || thread.pvIdx == 0) {
-                m_ttable.put(pos.key(), bestScore, rawStaticEval, bestMove, depth, ply, ttFlag, curr.ttpv);
+                m_ttable.put(
+                    pos.key(),
+                    bestScore,
+                    rawStaticEval,
+                    bestMove,
+                    depth,
+                    ply,
+                    ttFlag,
+                    curr.ttpv,
+                    thread.ttStats.get()
+                );
             }
         }
 
@@ -1375,7 +1537,7 @@ namespace stormphrax::search {
     ) {
         assert(ply > 0 && ply <= kMaxDepth);
 
-        if (thread.isMainThread() && thread.search.rootDepth > 1) {
+        if (thread.isMainThread() && thread.search.rootDepth > 1 && !pondering()) {
             if (m_limiter->stopHard(thread.search.loadNodes())) {
                 m_stop.store(true, std::memory_order::relaxed);
                 return 0;
@@ -1412,7 +1574,7 @@ namespace stormphrax::search {
         auto& curr = thread.stack[ply];
 
         ProbedTTableEntry ttEntry{};
-        const bool ttHit = m_ttable.probe(ttEntry, pos.key(), ply);
+        const bool ttHit = m_ttable.probeQsearch(ttEntry, pos.key(), ply, thread.ttStats.get());
 
         if (!kPvNode
             && (ttEntry.flag == TtFlag::kExact                                     //
@@ -1437,7 +1599,7 @@ namespace stormphrax::search {
             }
 
             if (!ttHit) {
-                m_ttable.putStaticEval(pos.key(), rawStaticEval, curr.ttpv);
+                m_ttable.putStaticEval(pos.key(), rawStaticEval, curr.ttpv, thread.ttStats.get());
             }
 
             const auto staticEval =
@@ -1552,7 +1714,17 @@ namespace stormphrax::search {
             return -kScoreMate + ply;
         }
 
-        m_ttable.put(pos.key(), bestScore, rawStaticEval, bestMove, 0, ply, ttFlag, curr.ttpv);
+        m_ttable.put(
+            pos.key(),
+            bestScore,
+            rawStaticEval,
+            bestMove,
+            0,
+            ply,
+            ttFlag,
+            curr.ttpv,
+            thread.ttStats.get()
+        );
 
         return bestScore;
     }
@@ -1785,6 +1957,12 @@ namespace stormphrax::search {
             report(bestThread, bestThread.depthCompleted, elapsed());
         }
 
-        println("bestmove {}", bestThread.pvMove().pv.moves[0]);
+        const auto& pv = bestThread.pvMove().pv;
+
+        if (g_opts.ponder && pv.length > 1) {
+            println("bestmove {} ponder {}", pv.moves[0], pv.moves[1]);
+        } else {
+            println("bestmove {}", pv.moves[0]);
+        }
     }
 } // namespace stormphrax::search
@@ -27,6 +27,8 @@
 #include <mutex>
 #include <optional>
 #include <span>
+#include <string>
+#include <string_view>
 #include <thread>
 #include <utility>
 #include <vector>
@@ -90,9 +92,13 @@ namespace stormphrax::search {
             std::span<const u64> keyHistory,
             util::Instant startTime,
             std::span<Move> moves,
-            bool infinite
+            bool infinite,
+            bool ponder = false
         );
 
+        // Switches a ponder search over to its limits, counted from startTime
+        void ponderhit(util::Instant startTime);
+
         void stop();
         void waitForStop();
 
@@ -110,8 +116,25 @@ namespace stormphrax::search {
             return m_searching.load(std::memory_order::relaxed);
         }
 
+        // Number of threads that have got past setup and into the current or last search
+        [[nodiscard]] inline u32 startedThreads() const {
+            return m_startedThreads.load(std::memory_order::acquire);
+        }
+
+        [[nodiscard]] inline bool pondering() const {
+            return m_pondering.load(std::memory_order::acquire);
+        }
+
         void setThreads(u32 threadCount);
 
+        // Nodes searched by each thread in the last search
+        [[nodiscard]] std::vector<usize> threadNodes() const;
+
+        // Time into the last search at which the main thread completed each depth, from depth 1
+        [[nodiscard]] inline std::span<const f64> depthTimes() const {
+            return m_depthTimes;
+        }
+
         [[nodiscard]] u32 threadCount() const {
             return m_threadData.size();
         }
@@ -120,6 +143,44 @@ namespace stormphrax::search {
             m_ttable.resize(mib);
         }
 
+        inline void setTtPageMode(util::PageMode mode) {
+            m_ttable.setPageMode(mode);
+        }
+
+        inline void setTtLayout(TtLayout layout) {
+            m_ttable.setLayout(layout);
+        }
+
+        inline void setTtSharedName(std::string name) {
+            m_ttable.setSharedName(std::move(name));
+        }
+
+        inline void setTtShallowSize(usize kib) {
+            m_ttable.setShallowSize(kib);
+        }
+
+        inline void setTtCollisionTracking(bool enabled) {
+            m_ttable.setCollisionTracking(enabled);
+        }
+
+        // Sum of the TT stats of all threads since the last
+        // ucinewgame or reset, or nothing if they are disabled
+        [[nodiscard]] std::optional<TtStats> ttStats() const;
+        void resetTtStats();
+
+        [[nodiscard]] TtOccupancy ttOccupancy();
+
+        [[nodiscard]] inline const TTable& ttable() const {
+            return m_ttable;
+        }
+
+        inline void setTtSnapshotFile(std::string path) {
+            m_ttable.loadOnInit(std::move(path));
+        }
+
+        bool saveTtSnapshot(std::string_view path);
+        bool loadTtSnapshot(std::string_view path);
+
         inline void setSilent(bool silent) {
             m_silent = silent;
         }
@@ -144,6 +205,11 @@ namespace stormphrax::search {
         std::atomic_bool m_quit{};
         std::atomic_bool m_searching{};
 
+        // threads at or past this count exit when next released from idle, and
+        // while resizing, the others go straight back to idle without searching
+        std::atomic<u32> m_threadCount{1};
+        std::atomic_bool m_resizing{};
+
         util::Instant m_startTime;
 
         util::Barrier m_initBarrier{2};
@@ -160,14 +226,25 @@ namespace stormphrax::search {
         std::condition_variable m_stopSignal{};
         std::atomic_int m_runningThreads{};
 
+        // guarded by m_stopMutex, set by stop() rather than the search stopping itself
+        bool m_stopRequested{};
+        std::condition_variable m_releaseSignal{};
+        std::atomic<u32> m_startedThreads{};
+
         std::optional<limit::SearchLimiter> m_limiter{};
 
         bool m_infinite{};
         i32 m_maxDepth{kMaxDepth};
 
+        // limits are ignored, and bestmove held back, until ponderhit or stop
+        std::atomic_bool m_pondering{};
+
         MoveList m_rootMoveList{};
         u32 m_multiPv{};
 
+        // main thread only
+        std::vector<f64> m_depthTimes{};
+
         Score m_minRootScore{};
         Score m_maxRootScore{};
 
@@ -21,6 +21,7 @@
 #include "types.h"
 
 #include <atomic>
+#include <memory>
 
 #include "correction.h"
 #include "eval/eval.h"
@@ -29,6 +30,7 @@
 #include "movepick.h"
 #include "pv.h"
 #include "root_move.h"
+#include "ttable.h"
 
 namespace stormphrax::search {
     struct SearchData {
@@ -164,6 +166,9 @@ namespace stormphrax::search {
 
         std::vector<u64> keyHistory{};
 
+        // null unless HashStats is enabled
+        std::unique_ptr<TtStats> ttStats{};
+
         [[nodiscard]] inline bool isMainThread() const {
             return id == 0;
         }
@@ -18,17 +18,24 @@
 
 #include "ttable.h"
 
+#include <algorithm>
+#include <cctype>
+#include <chrono>
 #include <cstring>
+#include <fstream>
 #include <thread>
-#include <vector>
 
 #ifndef _WIN32
+    #include <fcntl.h>
     #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
 #endif
 
 #include "opts.h"
 #include "util/align.h"
 #include "util/cemath.h"
+#include "util/numa/numa.h"
 
 namespace stormphrax {
     namespace {
@@ -52,38 +59,314 @@ namespace stormphrax {
             return score;
         }
 
-        inline u16 packEntryKey(u64 key) {
-            return static_cast<u16>(key);
+        template <typename Key>
+        inline Key packEntryKey(u64 key) {
+            return static_cast<Key>(key);
         }
+
+        constexpr std::array kTtLayoutNames = {"Compact", "Line", "Wide"};
+
+        // for layouts read from files or other processes
+        std::string_view storedLayoutName(u32 layout) {
+            return layout < kTtLayouts.size() ? ttLayoutName(static_cast<TtLayout>(layout)) : "unknown";
+        }
+
+        constexpr std::array kSnapshotMagic{'S', 'P', 'T', 'T'};
+        constexpr u16 kSnapshotVersion = 2;
+
+        struct SnapshotHeader {
+            std::array<char, 4> magic;
+            u16 version;
+            u16 clusterSize;
+            u32 entriesPerCluster;
+            u32 ageBits;
+            u32 age;
+            u32 layout;
+            u64 clusterCount;
+        };
+
+        static_assert(sizeof(SnapshotHeader) == 32);
+
+        constexpr std::array kSharedMagic{'S', 'P', 'S', 'H'};
+        constexpr u32 kSharedVersion = 2;
+
+        // the header gets its own page, so that the clusters stay page-aligned
+        constexpr usize kSharedHeaderSize = 4096;
+
+        // how long to wait for the creating process to fill in the header
+        constexpr auto kSharedReadyTimeout = std::chrono::seconds{1};
+
+        // the creator of a shared table may have died before filling in its header, in which case it is recreated
+        constexpr u32 kSharedAttachAttempts = 2;
     } // namespace
 
+    struct TTable::SharedHeader {
+        std::array<char, 4> magic;
+        u32 version;
+        u32 layout;
+        u32 clusterShift;
+        u64 clusterCount;
+        std::atomic<u32> ready;
+        // Highest search count of any attached process. Wraps
+        // around, only the low kAgeBits bits are used as the age
+        std::atomic<u32> age;
+    };
+
+    std::optional<TtLayout> parseTtLayout(std::string_view str) {
+        std::string lower{str};
+        std::ranges::transform(lower, lower.begin(), [](auto c) { return std::tolower(c); });
+
+        for (const auto layout : kTtLayouts) {
+            std::string name{ttLayoutName(layout)};
+            std::ranges::transform(name, name.begin(), [](auto c) { return std::tolower(c); });
+
+            if (lower == name) {
+                return layout;
+            }
+        }
+
+        return {};
+    }
+
+    std::string_view ttLayoutName(TtLayout layout) {
+        return kTtLayoutNames[static_cast<usize>(layout)];
+    }
+
+    template <typename F>
+    void TTable::parallelFor(usize count, const F& f) {
+        m_helpers.resize(g_opts.threads);
+
+        const auto chunkSize = util::ceilDiv<usize>(count, m_helpers.size());
+
+        m_helpers.dispatch([&f, count, chunkSize](u32 threadIdx) {
+            const auto start = std::min(chunkSize * threadIdx, count);
+            const auto end = std::min(start + chunkSize, count);
+
+            f(start, end);
+        });
+
+        m_helpers.wait();
+    }
+
     TTable::TTable(usize size) {
         resize(size);
     }
 
     TTable::~TTable() {
-        if (m_clusters) {
-            util::alignedFree(m_clusters);
-        }
+        releaseStorage();
+        util::alignedFree(m_shallowStorage);
     }
 
     void TTable::resize(usize mib) {
-        const auto clusters = mib * 1024 * 1024;
-        const auto capacity = clusters / sizeof(Cluster);
+        m_sizeMib = mib;
+        resizeStorage();
+    }
+
+    void TTable::setPageMode(util::PageMode mode) {
+        if (mode == m_pageMode) {
+            return;
+        }
+
+        m_pageMode = mode;
+
+        // shared tables are backed by the shared memory object whatever the
+        // page mode is, it only applies again if this one stops being shared
+        if (m_sharedHeader) {
+            return;
+        }
+
+        releaseStorage();
+        m_pendingInit = true;
+    }
 
-        // don't bother reallocating if we're already at the right size
-        if (m_clusterCount != capacity) {
-            if (m_clusters) {
-                util::alignedFree(m_clusters);
+    void TTable::setLayout(TtLayout layout) {
+        if (layout == m_layout) {
+            return;
+        }
+
+        // a background clear sizes its chunks for the current layout
+        waitForClear();
+
+        m_layout = layout;
+        m_clusterShift = visitLayout([]<typename C>() { return std::countr_zero(sizeof(C)); });
+
+        resizeStorage();
+        resizeShallowStorage();
+    }
+
+    void TTable::setSharedName(std::string name) {
+        if (name == m_sharedName) {
+            return;
+        }
+
+        releaseStorage();
+
+        m_sharedName = std::move(name);
+        m_pendingInit = true;
+    }
+
+    void TTable::setShallowSize(usize kib) {
+        if (kib == m_shallowSizeKib) {
+            return;
+        }
+
+        m_shallowSizeKib = kib;
+        resizeShallowStorage();
+    }
+
+    void TTable::resizeStorage() {
+        const auto bytes = m_sizeMib * 1024 * 1024;
+        const auto capacity = bytes >> m_clusterShift;
+
+        if (m_sharedHeader) {
+            // Keep a shared table, along with everything other processes have
+            // stored in it, unless its format actually changes
+            if (m_clusterCount == capacity && m_sharedHeader->layout == static_cast<u32>(m_layout)) {
+                return;
             }
 
-            m_clusters = nullptr;
+            releaseStorage();
             m_clusterCount = capacity;
+        } else if (m_clusterCount != capacity) {
+            // don't bother reallocating if we're already at the right size
+            releaseStorage();
+            m_clusterCount = capacity;
+        }
+
+        // cluster indices of tracked keys depend on the cluster count and layout
+        if (!m_fullKeys.empty()) {
+            setCollisionTracking(true);
         }
 
         m_pendingInit = true;
     }
 
+    void TTable::resizeShallowStorage() {
+        util::alignedFree(m_shallowStorage);
+
+        m_shallowStorage = nullptr;
+        m_shallowClusterCount = 0;
+
+        if (m_shallowSizeKib == 0) {
+            return;
+        }
+
+        const auto bytes = m_shallowSizeKib * 1024;
+
+        m_shallowStorage = util::alignedAlloc<std::byte>(clusterSize(), bytes);
+        m_shallowClusterCount = bytes >> m_clusterShift;
+
+        std::memset(m_shallowStorage, 0, bytes);
+    }
+
+    void TTable::releaseStorage() {
+        waitForClear();
+
+        if (m_sharedHeader) {
+            m_sharedHeader = nullptr;
+            util::releaseShared(m_shared, m_sharedName);
+        } else {
+            util::freePages(m_allocation);
+        }
+
+        m_storage = nullptr;
+    }
+
+    bool TTable::attachShared() {
+        static_assert(sizeof(SharedHeader) <= kSharedHeaderSize);
+
+        const auto tableSize = m_clusterCount * clusterSize();
+
+        for (u32 attempt = 0; attempt < kSharedAttachAttempts; ++attempt) {
+            auto mapping = util::mapShared(m_sharedName, kSharedHeaderSize + tableSize, kSharedReadyTimeout);
+
+            if (!mapping) {
+                break;
+            }
+
+            auto* header = static_cast<SharedHeader*>(mapping->ptr);
+
+            if (mapping->created) {
+                header->magic = kSharedMagic;
+                header->version = kSharedVersion;
+                header->layout = static_cast<u32>(m_layout);
+                header->clusterShift = m_clusterShift;
+                header->clusterCount = m_clusterCount;
+
+                header->ready.store(1, std::memory_order::release);
+                util::publishShared(*mapping);
+            } else {
+                const bool headerFits = mapping->size >= kSharedHeaderSize;
+
+                if (headerFits && header->ready.load(std::memory_order::acquire) == 0) {
+                    // mapShared() only returns once the creator is done, so it died
+                    util::releaseShared(*mapping, m_sharedName);
+                    continue;
+                }
+
+                if (!headerFits || header->magic != kSharedMagic || header->version != kSharedVersion) {
+                    println("info string {} is not a compatible shared TT, using a private table", m_sharedName);
+                    util::unmapShared(*mapping);
+                    return false;
+                }
+
+                if (header->layout != static_cast<u32>(m_layout) || header->clusterShift != m_clusterShift
+                    || header->clusterCount != m_clusterCount || mapping->size != kSharedHeaderSize + tableSize)
+                {
+                    println(
+                        "info string Shared TT {} holds {} MiB in the {} layout, but Hash is {} MiB "
+                        "and HashLayout is {}. Using a private table",
+                        m_sharedName,
+                        (header->clusterCount << header->clusterShift) / (1024 * 1024),
+                        storedLayoutName(header->layout),
+                        m_sizeMib,
+                        ttLayoutName(m_layout)
+                    );
+                    util::unmapShared(*mapping);
+                    return false;
+                }
+            }
+
+            m_shared = *mapping;
+            m_sharedHeader = header;
+
+            m_storage = static_cast<std::byte*>(m_shared.ptr) + kSharedHeaderSize;
+
+            m_generation = header->age.load(std::memory_order::relaxed);
+            m_age = m_generation & kAgeMask;
+
+            if (mapping->created) {
+                numa::interleave(m_storage, tableSize);
+            }
+
+            println("info string {} shared TT {}", mapping->created ? "Created" : "Attached to", m_sharedName);
+
+            return true;
+        }
+
+        println("info string Failed to open shared TT {}, using a private table", m_sharedName);
+        return false;
+    }
+
+    usize TTable::entriesPerCluster() const {
+        return visitLayout([]<typename C>() { return C::kEntriesPerCluster; });
+    }
+
+    u32 TTable::keyBits() const {
+        return visitLayout([]<typename C>() { return sizeof(typename C::EntryType::KeyType) * 8; });
+    }
+
+    void TTable::setCollisionTracking(bool enabled) {
+        m_fullKeys.clear();
+        m_fullKeys.shrink_to_fit();
+
+        if (enabled) {
+            m_fullKeys.resize(m_clusterCount * entriesPerCluster());
+        }
+
+        m_collisionStats = {};
+    }
+
     bool TTable::finalize() {
         if (!m_pendingInit) {
             return false;
@@ -91,75 +374,383 @@ namespace stormphrax {
 
         m_pendingInit = false;
 
-        if (!m_clusters) {
-#ifdef MADV_HUGEPAGE
-            //TODO handle 1GiB huge pages?
-            static constexpr usize kHugePageSize = 2 * 1024 * 1024;
-
-            const auto size = m_clusterCount * sizeof(Cluster);
-            const auto alignment = size >= kHugePageSize ? kHugePageSize : kDefaultStorageAlignment;
-#else
-            const auto alignment = kDefaultStorageAlignment;
-#endif
+        // falls back to a private table below if this fails
+        if (!m_storage && !m_sharedName.empty()) {
+            attachShared();
+        }
 
-            m_clusters = util::alignedAlloc<Cluster>(alignment, m_clusterCount);
+        if (!m_storage) {
+            m_allocation = util::allocatePages(m_clusterCount * clusterSize(), m_pageMode);
+            m_storage = static_cast<std::byte*>(m_allocation.ptr);
 
-            if (!m_clusters) {
+            if (!m_storage) {
                 println("info string Failed to reallocate TT - out of memory?");
                 std::terminate();
             }
 
-#ifdef MADV_HUGEPAGE
-            madvise(m_clusters, size, MADV_HUGEPAGE);
-#endif
+            // Must happen before the clear below first touches the table, otherwise
+            // pages end up on whichever node the clearing thread happened to run on
+            numa::interleave(m_storage, m_allocation.size);
+
+            // only worth mentioning if explicitly requested
+            if (m_pageMode != util::kDefaultPageMode) {
+                println(
+                    "info string TT backed by {} (requested {})",
+                    util::pageBackingName(m_allocation.backing),
+                    util::pageModeName(m_pageMode)
+                );
+            }
+        }
+
+        if (!m_pendingSnapshot.empty()) {
+            const auto path = std::move(m_pendingSnapshot);
+            m_pendingSnapshot.clear();
+
+            if (!load(path)) {
+                clear();
+            }
+        } else {
+            clear();
+        }
+
+        return true;
+    }
+
+    void TTable::loadOnInit(std::string path) {
+        m_pendingSnapshot = std::move(path);
+
+        if (!m_pendingSnapshot.empty()) {
+            m_pendingInit = true;
+        }
+    }
+
+    bool TTable::save(std::string_view path) {
+        assert(!m_pendingInit);
+
+        waitForClear();
+
+        std::ofstream stream{std::string{path}, std::ios::binary};
+
+        if (!stream) {
+            println("info string Failed to open TT snapshot {} for writing", path);
+            return false;
+        }
+
+        const SnapshotHeader header{
+            .magic = kSnapshotMagic,
+            .version = kSnapshotVersion,
+            .clusterSize = static_cast<u16>(clusterSize()),
+            .entriesPerCluster = static_cast<u32>(entriesPerCluster()),
+            .ageBits = kAgeBits,
+            .age = m_age,
+            .layout = static_cast<u32>(m_layout),
+            .clusterCount = m_clusterCount,
+        };
+
+        stream.write(reinterpret_cast<const char*>(&header), sizeof(SnapshotHeader));
+        stream.write(
+            reinterpret_cast<const char*>(m_storage),
+            static_cast<std::streamsize>(m_clusterCount * clusterSize())
+        );
+
+        if (!stream) {
+            println("info string Failed to write TT snapshot {}", path);
+            return false;
         }
 
-        clear();
+        println("info string Saved TT snapshot to {}", path);
 
         return true;
     }
 
-    bool TTable::probe(ProbedTTableEntry& dst, u64 key, i32 ply) const {
+    bool TTable::load(std::string_view path) {
         assert(!m_pendingInit);
 
-        const auto packedKey = packEntryKey(key);
+        waitForClear();
 
-        const auto& cluster = m_clusters[index(key)];
-        for (const auto entry : cluster.entries) {
-            if (entry.filled() && packedKey == entry.key) {
-                dst.score = scoreFromTt(static_cast<Score>(entry.score), ply);
-                dst.staticEval = static_cast<Score>(entry.staticEval);
-                dst.depth = entry.depth();
-                dst.move = entry.move;
-                dst.wasPv = entry.pv();
-                dst.flag = entry.flag();
+        const auto validate = [&](const SnapshotHeader& header, usize fileSize) {
+            if (header.magic != kSnapshotMagic) {
+                println("info string {} is not a TT snapshot", path);
+                return false;
+            }
+
+            if (header.version != kSnapshotVersion) {
+                println(
+                    "info string TT snapshot {} has unsupported format version {} (expected {})",
+                    path,
+                    header.version,
+                    kSnapshotVersion
+                );
+                return false;
+            }
 
-                return true;
+            if (header.layout != static_cast<u32>(m_layout)) {
+                println(
+                    "info string TT snapshot {} uses the {} layout, but HashLayout is {}",
+                    path,
+                    storedLayoutName(header.layout),
+                    ttLayoutName(m_layout)
+                );
+                return false;
             }
+
+            if (header.clusterSize != clusterSize() || header.entriesPerCluster != entriesPerCluster()
+                || header.ageBits != kAgeBits || header.age >= kAgeCycle)
+            {
+                println("info string TT snapshot {} was saved with an incompatible entry format", path);
+                return false;
+            }
+
+            if (header.clusterCount != m_clusterCount) {
+                println(
+                    "info string TT snapshot {} holds {} MiB, but Hash is {} MiB",
+                    path,
+                    (header.clusterCount << m_clusterShift) / (1024 * 1024),
+                    m_sizeMib
+                );
+                return false;
+            }
+
+            if (fileSize != sizeof(SnapshotHeader) + m_clusterCount * clusterSize()) {
+                println("info string TT snapshot {} is truncated", path);
+                return false;
+            }
+
+            return true;
+        };
+
+        const std::string pathStr{path};
+        SnapshotHeader header{};
+
+#ifndef _WIN32
+        const auto fd = open(pathStr.c_str(), O_RDONLY);
+
+        if (fd < 0) {
+            println("info string Failed to open TT snapshot {}", path);
+            return false;
         }
 
-        return false;
+        struct stat st{};
+
+        if (fstat(fd, &st) != 0 || static_cast<usize>(st.st_size) < sizeof(SnapshotHeader)) {
+            println("info string {} is not a TT snapshot", path);
+            close(fd);
+            return false;
+        }
+
+        const auto fileSize = static_cast<usize>(st.st_size);
+        auto* mapping = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        close(fd);
+
+        if (mapping == MAP_FAILED) {
+            println("info string Failed to map TT snapshot {}", path);
+            return false;
+        }
+
+        const auto* data = static_cast<const std::byte*>(mapping);
+        std::memcpy(&header, data, sizeof(SnapshotHeader));
+
+        if (!validate(header, fileSize)) {
+            munmap(mapping, fileSize);
+            return false;
+        }
+
+        madvise(mapping, fileSize, MADV_WILLNEED);
+
+        const auto* clusters = data + sizeof(SnapshotHeader);
+
+        parallelFor(m_clusterCount, [this, clusters](usize start, usize end) {
+            const auto offset = start << m_clusterShift;
+            std::memcpy(m_storage + offset, clusters + offset, (end - start) << m_clusterShift);
+        });
+
+        munmap(mapping, fileSize);
+#else
+        std::ifstream stream{pathStr, std::ios::binary | std::ios::ate};
+
+        if (!stream) {
+            println("info string Failed to open TT snapshot {}", path);
+            return false;
+        }
+
+        const auto fileSize = static_cast<usize>(stream.tellg());
+        stream.seekg(0);
+
+        if (fileSize < sizeof(SnapshotHeader)
+            || !stream.read(reinterpret_cast<char*>(&header), sizeof(SnapshotHeader)))
+        {
+            println("info string {} is not a TT snapshot", path);
+            return false;
+        }
+
+        if (!validate(header, fileSize)) {
+            return false;
+        }
+
+        const auto payloadSize = static_cast<std::streamsize>(m_clusterCount * clusterSize());
+
+        if (!stream.read(reinterpret_cast<char*>(m_storage), payloadSize)) {
+            println("info string Failed to read TT snapshot {}", path);
+            clear();
+            return false;
+        }
+#endif
+
+        // not part of snapshots
+        if (m_shallowStorage) {
+            std::memset(m_shallowStorage, 0, m_shallowClusterCount << m_clusterShift);
+        }
+
+        m_age = header.age;
+        m_restored = true;
+
+        if (m_sharedHeader) {
+            m_sharedHeader->age.store(m_age, std::memory_order::relaxed);
+        }
+
+        println("info string Loaded TT snapshot from {}", path);
+
+        return true;
+    }
+
+    bool TTable::probe(ProbedTTableEntry& dst, u64 key, i32 ply, TtStats* stats) const {
+        assert(!m_pendingInit);
+        return visitLayout([&]<typename C>() { return probe<C>(dst, key, ply, stats, false); });
     }
 
-    void TTable::put(u64 key, Score score, Score staticEval, Move move, i32 depth, i32 ply, TtFlag flag, bool pv) {
+    bool TTable::probeQsearch(ProbedTTableEntry& dst, u64 key, i32 ply, TtStats* stats) const {
         assert(!m_pendingInit);
+        return visitLayout([&]<typename C>() { return probe<C>(dst, key, ply, stats, true); });
+    }
+
+    void TTable::put(
+        u64 key,
+        Score score,
+        Score staticEval,
+        Move move,
+        i32 depth,
+        i32 ply,
+        TtFlag flag,
+        bool pv,
+        TtStats* stats
+    ) {
+        assert(!m_pendingInit);
+        visitLayout([&]<typename C>() { put<C>(key, score, staticEval, move, depth, ply, flag, pv, stats); });
+    }
+
+    template <typename C>
+    bool TTable::probe(ProbedTTableEntry& dst, u64 key, i32 ply, TtStats* stats, bool qsearch) const {
+        if (stats) [[unlikely]] {
+            ++stats->probes;
+        }
+
+        const auto packedKey = packEntryKey<typename C::EntryType::KeyType>(key);
+
+        const auto unpack = [&](const typename C::EntryType& entry) {
+            dst.score = scoreFromTt(static_cast<Score>(entry.score), ply);
+            dst.staticEval = static_cast<Score>(entry.staticEval);
+            dst.depth = entry.depth();
+            dst.move = entry.move;
+            dst.wasPv = entry.pv();
+            dst.flag = entry.flag();
+        };
+
+        bool shallowHit = false;
+
+        if (m_shallowStorage) {
+            const auto& cluster = shallowClusters<C>()[shallowIndex(key)];
+            for (const auto entry : cluster.entries) {
+                if (entry.filled() && packedKey == entry.key) {
+                    unpack(entry);
+                    shallowHit = true;
+                    break;
+                }
+            }
+        }
+
+        const auto idx = index(key);
+
+        if (cleared(idx)) {
+            const auto& cluster = clusters<C>()[idx];
+            for (usize i = 0; i < C::kEntriesPerCluster; ++i) {
+                const auto entry = cluster.entries[i];
+
+                if (entry.filled() && packedKey == entry.key) {
+                    if (!m_fullKeys.empty()) [[unlikely]] {
+                        ++m_collisionStats.hits;
+
+                        if (m_fullKeys[idx * C::kEntriesPerCluster + i] != key) {
+                            ++m_collisionStats.collisions;
+                        }
+                    }
+
+                    if (qsearch && shallowHit && entry.flag() == TtFlag::kNone && dst.flag != TtFlag::kNone) {
+                        break;
+                    }
+
+                    if (stats) [[unlikely]] {
+                        ++stats->hits;
+                    }
+
+                    unpack(entry);
+
+                    return true;
+                }
+            }
+        }
+
+        if (shallowHit) {
+            if (stats) [[unlikely]] {
+                ++stats->hits;
+                ++stats->shallowHits;
+            }
+
+            return true;
+        }
 
+        return false;
+    }
+
+    template <typename C>
+    void TTable::put(
+        u64 key,
+        Score score,
+        Score staticEval,
+        Move move,
+        i32 depth,
+        i32 ply,
+        TtFlag flag,
+        bool pv,
+        TtStats* stats
+    ) {
         assert(depth > -kDepthOffset);
         assert(depth <= kMaxDepth);
 
         assert(staticEval == kScoreNone || staticEval > -kScoreWin);
         assert(staticEval == kScoreNone || staticEval < kScoreWin);
 
-        const auto newKey = packEntryKey(key);
+        const auto newKey = packEntryKey<typename C::EntryType::KeyType>(key);
 
         const auto entryValue = [this](const auto& entry) {
-            const i32 relativeAge = (Entry::kAgeCycle + m_age - entry.age()) & Entry::kAgeMask;
+            const i32 relativeAge = (kAgeCycle + m_age - entry.age()) & kAgeMask;
             return entry.depth() - relativeAge * 2;
         };
 
-        auto& cluster = m_clusters[index(key)];
+        const bool shallow = m_shallowStorage && depth <= 0;
+        const auto idx = shallow ? shallowIndex(key) : index(key);
+
+        // would be wiped by the background clear anyway
+        if (!shallow && !cleared(idx)) {
+            if (stats) [[unlikely]] {
+                ++stats->droppedWrites;
+            }
+            return;
+        }
+
+        auto& cluster = shallow ? shallowClusters<C>()[idx] : clusters<C>()[idx];
 
-        Entry* entryPtr = nullptr;
+        typename C::EntryType* entryPtr = nullptr;
         auto minValue = std::numeric_limits<i32>::max();
 
         for (auto& candidate : cluster.entries) {
@@ -186,9 +777,29 @@ namespace stormphrax {
         if (!(flag == TtFlag::kExact || newKey != entry.key || entry.age() != m_age
               || depth + 4 + pv * 2 > entry.depth()))
         {
+            if (stats) [[unlikely]] {
+                ++stats->rejectedWrites;
+            }
             return;
         }
 
+        if (stats) [[unlikely]] {
+            if (!entry.filled()) {
+                ++stats->emptyWrites;
+            } else if (entry.key == newKey) {
+                ++stats->sameKeyWrites;
+            } else {
+                ++stats->evictions;
+            }
+
+            if (shallow) {
+                ++stats->shallowWrites;
+            }
+
+            const auto bucket = std::clamp(depth, 0, static_cast<i32>(TtStats::kDepthBuckets) - 1);
+            ++stats->storedDepths[bucket];
+        }
+
         if (move || entry.key != newKey) {
             entry.move = move;
         }
@@ -200,43 +811,122 @@ namespace stormphrax {
         entry.setAgePvFlag(m_age, pv, flag);
 
         *entryPtr = entry;
+
+        if (!shallow && !m_fullKeys.empty()) [[unlikely]] {
+            const auto slot = static_cast<usize>(entryPtr - cluster.entries.data());
+            m_fullKeys[idx * C::kEntriesPerCluster + slot] = key;
+        }
     }
 
     void TTable::clear() {
         assert(!m_pendingInit);
 
-        const auto threadCount = g_opts.threads;
+        waitForClear();
 
-        std::vector<std::thread> threads{};
-        threads.reserve(threadCount);
+        if (m_shallowStorage) {
+            std::memset(m_shallowStorage, 0, m_shallowClusterCount << m_clusterShift);
+        }
 
-        const auto chunkSize = util::ceilDiv<usize>(m_clusterCount, threadCount);
+        if (m_sharedHeader) {
+            // don't wipe out the work of other processes still using the table
+            if (util::sharedWithOthers(m_shared)) {
+                age();
+                return;
+            }
 
-        for (u32 i = 0; i < threadCount; ++i) {
-            threads.emplace_back([this, chunkSize, i] {
-                const auto start = chunkSize * i;
-                const auto end = std::min(start + chunkSize, m_clusterCount);
+            m_sharedHeader->age.store(0, std::memory_order::relaxed);
+            m_generation = 0;
+        }
 
-                const auto count = end - start;
+        m_clearChunkShift = kClearChunkByteShift - m_clusterShift;
 
-                std::memset(&m_clusters[start], 0, count * sizeof(Cluster));
-            });
-        }
+        const auto chunkClusters = usize{1} << m_clearChunkShift;
+        const auto chunkCount = util::ceilDiv(m_clusterCount, chunkClusters);
+
+        m_clearedChunks = std::vector<std::atomic_bool>(chunkCount);
+
+        m_nextClearChunk.store(0, std::memory_order::relaxed);
+        m_remainingClearChunks.store(chunkCount, std::memory_order::relaxed);
+
+        m_clearing.store(true, std::memory_order::release);
 
         m_age = 0;
+        m_restored = false;
+
+        // the table's shape is captured by value, so nothing the helpers read can change under them
+        m_helpers.resize(g_opts.threads);
+        m_helpers.dispatch([this,
+                            storage = m_storage,
+                            clusterShift = m_clusterShift,
+                            clusterCount = m_clusterCount,
+                            chunkClusters,
+                            chunkCount](u32) {
+            // hand out chunks in order, so the start of the table becomes usable first
+            while (true) {
+                const auto chunk = m_nextClearChunk.fetch_add(1, std::memory_order::relaxed);
+
+                if (chunk >= chunkCount) {
+                    break;
+                }
+
+                const auto start = chunk * chunkClusters;
+                const auto end = std::min(start + chunkClusters, clusterCount);
+
+                std::memset(storage + (start << clusterShift), 0, (end - start) << clusterShift);
+
+                m_clearedChunks[chunk].store(true, std::memory_order::release);
 
-        for (auto& thread : threads) {
-            thread.join();
+                if (m_remainingClearChunks.fetch_sub(1, std::memory_order::acq_rel) == 1) {
+                    m_clearing.store(false, std::memory_order::release);
+                }
+            }
+        });
+    }
+
+    void TTable::age() {
+        if (m_sharedHeader) {
+            // Each attached process counts its own searches, and the table is aged to the
+            // highest count among them, so engines taking turns in the same game age it
+            // once per move between them rather than once per move each. A process that
+            // has fallen behind catches up instead of pushing the age further
+            auto shared = m_sharedHeader->age.load(std::memory_order::relaxed);
+            m_generation = std::max(m_generation + 1, shared);
+
+            while (shared < m_generation
+                   && !m_sharedHeader->age.compare_exchange_weak(shared, m_generation, std::memory_order::relaxed))
+            {
+                //
+            }
+
+            m_generation = std::max(m_generation, shared);
+            m_age = m_generation & kAgeMask;
+        } else {
+            m_age = (m_age + 1) % kAgeCycle;
         }
+
+        m_restored = false;
+    }
+
+    void TTable::waitForClear() {
+        m_helpers.wait();
     }
 
     u32 TTable::full() const {
         assert(!m_pendingInit);
+        return visitLayout([&]<typename C>() { return full<C>(); });
+    }
+
+    template <typename C>
+    u32 TTable::full() const {
+        // the sampled clusters all lie in the first chunk
+        if (!cleared(0)) {
+            return 0;
+        }
 
         u32 filledEntries{};
 
         for (u64 i = 0; i < 1000; ++i) {
-            const auto cluster = m_clusters[i];
+            const auto& cluster = clusters<C>()[i];
             for (const auto& entry : cluster.entries) {
                 if (entry.filled() && entry.age() == m_age) {
                     ++filledEntries;
@@ -244,6 +934,94 @@ namespace stormphrax {
             }
         }
 
-        return filledEntries / Cluster::kEntriesPerCluster;
+        return filledEntries / C::kEntriesPerCluster;
+    }
+
+    TtOccupancy TTable::occupancy() const {
+        assert(!m_pendingInit);
+        return visitLayout([&]<typename C>() { return occupancy<C>(); });
+    }
+
+    template <typename C>
+    TtOccupancy TTable::occupancy() const {
+        TtOccupancy occupancy{};
+
+        occupancy.entries = m_clusterCount * C::kEntriesPerCluster;
+
+        for (usize i = 0; i < m_clusterCount; ++i) {
+            if (!cleared(i)) {
+                continue;
+            }
+
+            for (const auto& entry : clusters<C>()[i].entries) {
+                if (entry.filled()) {
+                    ++occupancy.filled;
+
+                    if (entry.age() == m_age) {
+                        ++occupancy.current;
+                    }
+                }
+            }
+        }
+
+        return occupancy;
+    }
+
+    TtStats& TtStats::operator+=(const TtStats& other) {
+        probes += other.probes;
+        hits += other.hits;
+        shallowHits += other.shallowHits;
+
+        emptyWrites += other.emptyWrites;
+        sameKeyWrites += other.sameKeyWrites;
+        evictions += other.evictions;
+        rejectedWrites += other.rejectedWrites;
+        droppedWrites += other.droppedWrites;
+        shallowWrites += other.shallowWrites;
+
+        for (usize i = 0; i < kDepthBuckets; ++i) {
+            storedDepths[i] += other.storedDepths[i];
+        }
+
+        return *this;
+    }
+
+    void TtStats::print() const {
+        const auto percent = [](usize n, usize total) {
+            return total == 0 ? 0.0 : static_cast<f64>(n) * 100.0 / static_cast<f64>(total);
+        };
+
+        const auto writes = emptyWrites + sameKeyWrites + evictions;
+        const auto attempts = writes + rejectedWrites + droppedWrites;
+
+        println("TT probes: {}", probes);
+        println("    hits: {} ({:.2f}%)", hits, percent(hits, probes));
+        println("    shallow table hits: {} ({:.2f}%)", shallowHits, percent(shallowHits, probes));
+
+        println("TT writes: {} of {} attempted", writes, attempts);
+        println("    empty: {} ({:.2f}%)", emptyWrites, percent(emptyWrites, attempts));
+        println("    same key: {} ({:.2f}%)", sameKeyWrites, percent(sameKeyWrites, attempts));
+        println("    evicted by depth/age: {} ({:.2f}%)", evictions, percent(evictions, attempts));
+        println("    rejected: {} ({:.2f}%)", rejectedWrites, percent(rejectedWrites, attempts));
+        println("    dropped while clearing: {} ({:.2f}%)", droppedWrites, percent(droppedWrites, attempts));
+        println("    to shallow table: {} ({:.2f}%)", shallowWrites, percent(shallowWrites, attempts));
+
+        println("TT stored depths:");
+
+        for (usize depth = 0; depth < kDepthBuckets; ++depth) {
+            const auto count = storedDepths[depth];
+
+            if (count == 0) {
+                continue;
+            }
+
+            if (depth == 0) {
+                println("    <= 0: {} ({:.2f}%)", count, percent(count, writes));
+            } else if (depth == kDepthBuckets - 1) {
+                println("    {}+: {} ({:.2f}%)", depth, count, percent(count, writes));
+            } else {
+                println("    {}: {} ({:.2f}%)", depth, count, percent(count, writes));
+            }
+        }
     }
 } // namespace stormphrax
@@ -23,16 +23,27 @@
 #include <array>
 #include <atomic>
 #include <bit>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
 
 #include "arch.h"
 #include "core.h"
 #include "move.h"
+#include "util/helper_pool.h"
+#include "util/pages.h"
+#include "util/shared_memory.h"
 #include "util/range.h"
 
 namespace stormphrax {
     constexpr usize kDefaultTtSizeMib = 64;
     constexpr util::Range<usize> kTtSizeMibRange{1, 67108864};
 
+    // 0 disables the shallow table
+    constexpr usize kDefaultTtShallowSizeKib = 0;
+    constexpr util::Range<usize> kTtShallowSizeKibRange{0, 65536};
+
     enum class TtFlag : u8 {
         kNone = 0,
         kUpperBound,
@@ -40,6 +51,22 @@ namespace stormphrax {
         kExact,
     };
 
+    // Cluster formats:
+    //  - compact: 3 entries with 16-bit keys in 32 bytes
+    //  - line: 6 entries with 16-bit keys in a 64-byte cache line
+    //  - wide: 5 entries with 32-bit keys in a 64-byte cache line
+    enum class TtLayout : u8 {
+        kCompact = 0,
+        kLine,
+        kWide,
+    };
+
+    constexpr auto kDefaultTtLayout = TtLayout::kCompact;
+    constexpr std::array kTtLayouts = {TtLayout::kCompact, TtLayout::kLine, TtLayout::kWide};
+
+    [[nodiscard]] std::optional<TtLayout> parseTtLayout(std::string_view str);
+    [[nodiscard]] std::string_view ttLayoutName(TtLayout layout);
+
     struct ProbedTTableEntry {
         Score score;
         Score staticEval;
@@ -49,44 +76,156 @@ namespace stormphrax {
         TtFlag flag;
     };
 
+    struct TtCollisionStats {
+        usize hits{};
+        usize collisions{};
+    };
+
+    // TT usage counters. Collected per thread when enabled, so that
+    // counting does not introduce any sharing between search threads
+    struct TtStats {
+        // bucket 0 holds depths <= 0, the last bucket holds everything deeper
+        static constexpr usize kDepthBuckets = 65;
+
+        usize probes{};
+        usize hits{};
+        // hits served from the shallow table, included in hits
+        usize shallowHits{};
+
+        // writes into an empty entry
+        usize emptyWrites{};
+        // writes updating the entry for the same key
+        usize sameKeyWrites{};
+        // writes evicting the lowest-valued entry by depth and age
+        usize evictions{};
+        // writes refused by the replacement scheme
+        usize rejectedWrites{};
+        // writes dropped because their cluster had not been cleared yet
+        usize droppedWrites{};
+        // writes that went to the shallow table, included in the above
+        usize shallowWrites{};
+
+        // depths of the entries actually written
+        std::array<usize, kDepthBuckets> storedDepths{};
+
+        TtStats& operator+=(const TtStats& other);
+
+        void print() const;
+    };
+
+    struct TtOccupancy {
+        usize entries{};
+        usize filled{};
+        // filled with an entry from the current search
+        usize current{};
+    };
+
     class TTable {
     public:
         explicit TTable(usize mib = kDefaultTtSizeMib);
         ~TTable();
 
         void resize(usize mib);
+        void setPageMode(util::PageMode mode);
+        void setLayout(TtLayout layout);
+
+        // Entries with depth <= 0 (qsearch and static eval stores) go to a small table
+        // of this size instead, which is meant to fit in L2 so that they do not cost a
+        // DRAM access each or evict deep entries from the main table. 0 disables it
+        void setShallowSize(usize kib);
+
+        // Backs the table with the named POSIX shared memory object, so that engine processes
+        // on the same host can share one table. The first process creates it, later ones attach
+        // if their Hash and HashLayout match, or fall back to a private table. Empty disables
+        void setSharedName(std::string name);
+
         bool finalize();
 
-        bool probe(ProbedTTableEntry& dst, u64 key, i32 ply) const;
-        void put(u64 key, Score score, Score staticEval, Move move, i32 depth, i32 ply, TtFlag flag, bool pv);
+        // Restore the given snapshot instead of clearing on the next finalisation
+        void loadOnInit(std::string path);
 
-        inline void putStaticEval(u64 key, Score staticEval, bool pv) {
-            static constexpr i32 kStaticEvalDepth = -kDepthOffset + 1;
-            put(key, kScoreNone, staticEval, kNullMove, kStaticEvalDepth, 0, TtFlag::kNone, pv);
+        bool save(std::string_view path);
+        bool load(std::string_view path);
+
+        // Whether the table was restored from a snapshot that has not been searched with yet
+        [[nodiscard]] inline bool restored() const {
+            return m_restored;
+        }
+
+        [[nodiscard]] inline TtLayout layout() const {
+            return m_layout;
+        }
+
+        [[nodiscard]] usize entriesPerCluster() const;
+        [[nodiscard]] u32 keyBits() const;
+
+        // Keeps the full key of every stored entry on the side, to count false-positive hits.
+        // Slow and memory-hungry, only meant for benchmarking layouts. Not thread-safe
+        void setCollisionTracking(bool enabled);
+
+        [[nodiscard]] inline TtCollisionStats collisionStats() const {
+            return m_collisionStats;
         }
 
-        inline void age() {
-            m_age = (m_age + 1) % (1 << Entry::kAgeBits);
+        // Checks the shallow table first, but prefers a hit in the main table if there is one.
+        // stats may be null, in which case nothing is counted
+        bool probe(ProbedTTableEntry& dst, u64 key, i32 ply, TtStats* stats = nullptr) const;
+
+        // As above, but for qsearch, which can cut on a bound of any depth. A shallow table
+        // hit with a bound is also preferred over a main table hit with only a static eval
+        bool probeQsearch(ProbedTTableEntry& dst, u64 key, i32 ply, TtStats* stats = nullptr) const;
+        void put(
+            u64 key,
+            Score score,
+            Score staticEval,
+            Move move,
+            i32 depth,
+            i32 ply,
+            TtFlag flag,
+            bool pv,
+            TtStats* stats = nullptr
+        );
+
+        inline void putStaticEval(u64 key, Score staticEval, bool pv, TtStats* stats = nullptr) {
+            static constexpr i32 kStaticEvalDepth = -kDepthOffset + 1;
+            put(key, kScoreNone, staticEval, kNullMove, kStaticEvalDepth, 0, TtFlag::kNone, pv, stats);
         }
 
+        void age();
+
+        // Starts clearing the table in the background and returns immediately. Until
+        // the clear finishes, the table can still be searched with - the parts that
+        // have not been cleared yet are treated as empty, and writes to them are dropped.
+        // A shared table that other processes are attached to is only aged instead
         void clear();
+        void waitForClear();
+
+        [[nodiscard]] inline bool clearing() const {
+            return m_clearing.load(std::memory_order::relaxed);
+        }
 
         [[nodiscard]] u32 full() const;
 
+        // Scans the whole table, unlike full()
+        [[nodiscard]] TtOccupancy occupancy() const;
+
         inline void prefetch(u64 key) {
-            __builtin_prefetch(&m_clusters[index(key)]);
+            __builtin_prefetch(&m_storage[index(key) << m_clusterShift]);
         }
 
     private:
         static constexpr i32 kDepthOffset = 7;
 
-        struct Entry {
-            static constexpr u32 kAgeBits = 5;
+        static constexpr u32 kAgeBits = 5;
+
+        static constexpr u32 kAgeCycle = 1 << kAgeBits;
+        static constexpr u32 kAgeMask = kAgeCycle - 1;
 
-            static constexpr u32 kAgeCycle = 1 << kAgeBits;
-            static constexpr u32 kAgeMask = kAgeCycle - 1;
+        template <typename Key>
+        struct Entry {
+            using KeyType = Key;
 
-            u16 key;
+            Key key;
             i16 score;
             i16 staticEval;
             Move move;
@@ -123,32 +262,148 @@ namespace stormphrax {
             }
         };
 
-        static_assert(sizeof(Entry) == 10);
+        static_assert(sizeof(Entry<u16>) == 10);
+        static_assert(sizeof(Entry<u32>) == 12);
 
-        static constexpr usize kSmallPageSize = 4096;
-        static constexpr auto kDefaultStorageAlignment = std::max(kCacheLineSize, kSmallPageSize);
+        template <typename E, usize kEntries, usize kSize>
+        struct alignas(kSize) Cluster {
+            using EntryType = E;
 
-        struct alignas(32) Cluster {
-            static constexpr usize kEntriesPerCluster = 3;
-            static constexpr usize kPadding =
-                std::bit_ceil(sizeof(Entry) * kEntriesPerCluster) - sizeof(Entry) * kEntriesPerCluster;
+            static constexpr usize kEntriesPerCluster = kEntries;
+            static constexpr usize kPadding = kSize - sizeof(E) * kEntriesPerCluster;
 
-            std::array<Entry, kEntriesPerCluster> entries{};
-            // round up to nearest power of 2 bytes
+            std::array<E, kEntriesPerCluster> entries{};
+            // pad to a power of 2 bytes
             [[maybe_unused]] std::array<u8, kPadding> padding_{};
         };
 
+        using CompactCluster = Cluster<Entry<u16>, 3, 32>;
+        using LineCluster = Cluster<Entry<u16>, 6, 64>;
+        using WideCluster = Cluster<Entry<u32>, 5, 64>;
+
+        static_assert(sizeof(CompactCluster) == 32);
+        static_assert(sizeof(LineCluster) == 64);
+        static_assert(sizeof(WideCluster) == 64);
+
+        // 2 MiB, regardless of layout
+        static constexpr usize kClearChunkByteShift = 21;
+
+        // Calls f.template operator()<ClusterType>() for the current layout
+        template <typename F>
+        inline decltype(auto) visitLayout(F&& f) const {
+            switch (m_layout) {
+                case TtLayout::kLine:
+                    return f.template operator()<LineCluster>();
+                case TtLayout::kWide:
+                    return f.template operator()<WideCluster>();
+                default:
+                    return f.template operator()<CompactCluster>();
+            }
+        }
+
+        template <typename C>
+        [[nodiscard]] inline C* clusters() const {
+            return reinterpret_cast<C*>(m_storage);
+        }
+
+        [[nodiscard]] inline usize clusterSize() const {
+            return usize{1} << m_clusterShift;
+        }
+
         [[nodiscard]] inline u64 index(u64 key) const {
             // this emits a single mul on both x64 and arm64
             return static_cast<u64>((static_cast<u128>(key) * static_cast<u128>(m_clusterCount)) >> 64);
         }
 
+        [[nodiscard]] inline bool cleared(u64 idx) const {
+            // acquire, so that seeing the end of a clear also makes the cleared memory visible
+            return !m_clearing.load(std::memory_order::acquire)
+                || m_clearedChunks[idx >> m_clearChunkShift].load(std::memory_order::acquire);
+        }
+
+        [[nodiscard]] inline u64 shallowIndex(u64 key) const {
+            return static_cast<u64>((static_cast<u128>(key) * static_cast<u128>(m_shallowClusterCount)) >> 64);
+        }
+
+        template <typename C>
+        [[nodiscard]] inline C* shallowClusters() const {
+            return reinterpret_cast<C*>(m_shallowStorage);
+        }
+
+        template <typename C>
+        bool probe(ProbedTTableEntry& dst, u64 key, i32 ply, TtStats* stats, bool qsearch) const;
+
+        template <typename C>
+        void put(
+            u64 key,
+            Score score,
+            Score staticEval,
+            Move move,
+            i32 depth,
+            i32 ply,
+            TtFlag flag,
+            bool pv,
+            TtStats* stats
+        );
+
+        template <typename C>
+        [[nodiscard]] u32 full() const;
+
+        template <typename C>
+        [[nodiscard]] TtOccupancy occupancy() const;
+
+        struct SharedHeader;
+
+        void resizeStorage();
+        void releaseStorage();
+
+        bool attachShared();
+        void resizeShallowStorage();
+
+        // Splits [0, count) into one chunk per helper thread, runs f(start, end) on each and waits for them
+        template <typename F>
+        void parallelFor(usize count, const F& f);
+
         // Only accessed from UCI thread
         bool m_pendingInit{};
+        std::string m_pendingSnapshot{};
+        bool m_restored{};
+
+        util::PageMode m_pageMode{util::kDefaultPageMode};
+        util::PageAllocation m_allocation{};
+
+        TtLayout m_layout{kDefaultTtLayout};
+        u32 m_clusterShift{std::countr_zero(sizeof(CompactCluster))};
 
-        Cluster* m_clusters{};
+        usize m_sizeMib{};
+
+        std::byte* m_storage{};
         usize m_clusterCount{};
 
         u32 m_age{};
+        // searches this process has made in a shared table, see age()
+        u32 m_generation{};
+
+        std::string m_sharedName{};
+        util::SharedMapping m_shared{};
+        SharedHeader* m_sharedHeader{};
+
+        usize m_shallowSizeKib{kDefaultTtShallowSizeKib};
+
+        // Small enough to allocate and clear synchronously
+        std::byte* m_shallowStorage{};
+        usize m_shallowClusterCount{};
+
+        std::vector<u64> m_fullKeys{};
+        mutable TtCollisionStats m_collisionStats{};
+
+        util::HelperPool m_helpers{};
+
+        std::atomic_bool m_clearing{};
+        // in clusters
+        u32 m_clearChunkShift{};
+        std::vector<std::atomic_bool> m_clearedChunks{};
+        std::atomic<usize> m_nextClearChunk{};
+        std::atomic<usize> m_remainingClearChunks{};
     };
 } // namespace stormphrax
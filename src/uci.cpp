@@ -28,6 +28,7 @@
 #include "../3rdparty/pyrrhic/tbprobe.h"
 #include "bench.h"
 #include "eval/eval.h"
+#include "eval/evalbench.h"
 #include "limit.h"
 #include "movegen.h"
 #include "opts.h"
@@ -37,6 +38,7 @@
 #include "tb.h"
 #include "ttable.h"
 #include "tunable.h"
+#include "util/pages.h"
 #include "util/parse.h"
 #include "util/split.h"
 #include "util/timer.h"
@@ -74,6 +76,48 @@ namespace stormphrax {
         }
 #endif
 
+        // [depth] [tt size] for the bench variants, prints an error and returns nothing if invalid
+        std::optional<std::pair<i32, usize>> parseBenchArgs(std::span<const std::string_view> args) {
+            i32 depth = bench::kDefaultBenchDepth;
+            usize ttSize = bench::kDefaultBenchTtSize;
+
+            if (args.size() > 0) {
+                if (const auto newDepth = util::tryParse<u32>(args[0])) {
+                    depth = std::max(static_cast<i32>(*newDepth), 1);
+                } else {
+                    eprintln("invalid depth {}", args[0]);
+                    return {};
+                }
+            }
+
+            if (args.size() > 1) {
+                if (const auto newTtSize = util::tryParse<usize>(args[1])) {
+                    ttSize = kTtSizeMibRange.clamp(*newTtSize);
+                } else {
+                    eprintln("invalid tt size {}", args[1]);
+                    return {};
+                }
+            }
+
+            return std::pair{depth, ttSize};
+        }
+
+        // for paths containing spaces
+        std::string joinArgs(std::span<const std::string_view> args) {
+            std::string result{};
+            auto itr = std::back_inserter(result);
+
+            for (const auto arg : args) {
+                if (!result.empty()) {
+                    fmt::format_to(itr, " ");
+                }
+
+                fmt::format_to(itr, "{}", arg);
+            }
+
+            return result;
+        }
+
         class UciHandler {
         public:
             ~UciHandler();
@@ -87,6 +131,7 @@ namespace stormphrax {
             void handlePosition(std::span<const std::string_view> args);
             void handleGo(std::span<const std::string_view> args, Instant startTime);
             void handleStop();
+            void handlePonderhit(Instant startTime);
             void handleSetoption(std::span<const std::string_view> args);
             // V ======= NONSTANDARD ======= V
             void handleD();
@@ -100,9 +145,18 @@ namespace stormphrax {
             void handlePerft(std::span<const std::string_view> args);
             void handleSplitperft(std::span<const std::string_view> args);
             void handleBench(std::span<const std::string_view> args);
+            void handleTtbench(std::span<const std::string_view> args);
+            void handleEvalcachebench(std::span<const std::string_view> args);
+            void handleEvalpagesbench(std::span<const std::string_view> args);
+            void handleLatencybench(std::span<const std::string_view> args);
+            void handleScalingbench(std::span<const std::string_view> args);
+            void handleEvalbench();
             void handleProbeWdl();
             void handleWait();
             void handleMove(std::span<const std::string_view> args);
+            void handleSavehash(std::span<const std::string_view> args);
+            void handleLoadhash(std::span<const std::string_view> args);
+            void handleTtstats(std::span<const std::string_view> args);
 
             bool m_quit{false};
 
@@ -152,6 +206,8 @@ namespace stormphrax {
                     handleGo(args, startTime);
                 } else if (command == "stop") {
                     handleStop();
+                } else if (command == "ponderhit") {
+                    handlePonderhit(startTime);
                 } else if (command == "setoption") {
                     handleSetoption(args);
                     // V ======= NONSTANDARD ======= V
@@ -177,12 +233,30 @@ namespace stormphrax {
                     handleSplitperft(args);
                 } else if (command == "bench") {
                     handleBench(args);
+                } else if (command == "ttbench") {
+                    handleTtbench(args);
+                } else if (command == "evalcachebench") {
+                    handleEvalcachebench(args);
+                } else if (command == "evalpagesbench") {
+                    handleEvalpagesbench(args);
+                } else if (command == "latencybench") {
+                    handleLatencybench(args);
+                } else if (command == "scalingbench") {
+                    handleScalingbench(args);
+                } else if (command == "evalbench") {
+                    handleEvalbench();
                 } else if (command == "probewdl") {
                     handleProbeWdl();
                 } else if (command == "wait") {
                     handleWait();
                 } else if (command == "move") {
                     handleMove(args);
+                } else if (command == "savehash") {
+                    handleSavehash(args);
+                } else if (command == "loadhash") {
+                    handleLoadhash(args);
+                } else if (command == "ttstats") {
+                    handleTtstats(args);
                 }
 
                 if (m_quit) {
@@ -210,6 +284,23 @@ namespace stormphrax {
                 kTtSizeMibRange.max()
             );
             println("option name Clear Hash type button");
+            println(
+                "option name HashPages type combo default {} var THP var Huge2M var Huge1G var Plain",
+                util::pageModeName(util::kDefaultPageMode)
+            );
+            println(
+                "option name HashLayout type combo default {} var Compact var Line var Wide",
+                ttLayoutName(kDefaultTtLayout)
+            );
+            println(
+                "option name HashShallow type spin default {} min {} max {}",
+                kDefaultTtShallowSizeKib,
+                kTtShallowSizeKibRange.min(),
+                kTtShallowSizeKibRange.max()
+            );
+            println("option name HashFile type string default <empty>");
+            println("option name HashShared type string default <empty>");
+            println("option name HashStats type check default {}", defaultOpts.ttStats);
             println(
                 "option name Threads type spin default {} min {} max {}",
                 opts::kDefaultThreadCount,
@@ -251,7 +342,14 @@ namespace stormphrax {
                 opts::kSoftNodeHardLimitMultiplierRange.max()
             );
             println("option name EnableWeirdTCs type check default {}", defaultOpts.enableWeirdTcs);
+            println("option name Ponder type check default {}", defaultOpts.ponder);
             println("option name Minimal type check default {}", defaultOpts.minimal);
+            println("option name EvalFile type string default <internal>");
+            println(
+                "option name EvalPages type combo default {} var THP var Huge2M var Huge1G var Plain",
+                util::pageModeName(eval::kDefaultNetworkPageMode)
+            );
+            println("option name EvalCache type check default {}", defaultOpts.evalCache);
             println("option name SyzygyPath type string default <empty>");
             println(
                 "option name SyzygyProbeDepth type spin default {} min {} max {}",
@@ -410,6 +508,7 @@ namespace stormphrax {
             limit::SearchLimiter limiter{startTime};
 
             bool infinite = false;
+            bool ponder = false;
 
             auto maxDepth = kMaxDepth;
 
@@ -426,6 +525,8 @@ namespace stormphrax {
 
                 if (limitStr == "infinite") {
                     infinite = true;
+                } else if (limitStr == "ponder") {
+                    ponder = true;
                 } else if (limitStr == "depth") {
                     if (++i == args.size()) {
                         eprintln("Missing depth");
@@ -625,7 +726,7 @@ namespace stormphrax {
             m_searcher.setLimiter(limiter);
             m_searcher.setMaxDepth(maxDepth);
 
-            m_searcher.startSearch(m_pos, m_keyHistory, startTime, movesToSearch, infinite);
+            m_searcher.startSearch(m_pos, m_keyHistory, startTime, movesToSearch, infinite, ponder);
         }
 
         void UciHandler::handleStop() {
@@ -637,6 +738,15 @@ namespace stormphrax {
             m_searcher.stop();
         }
 
+        void UciHandler::handlePonderhit(Instant startTime) {
+            if (!m_searcher.searching() || !m_searcher.pondering()) {
+                eprintln("not pondering");
+                return;
+            }
+
+            m_searcher.ponderhit(startTime);
+        }
+
         //TODO refactor
         void UciHandler::handleSetoption(std::span<const std::string_view> args) {
             if (m_searcher.searching()) {
@@ -699,6 +809,34 @@ namespace stormphrax {
                     }
 
                     m_searcher.newGame();
+                } else if (name == "hashpages") {
+                    if (const auto newPageMode = util::parsePageMode(value)) {
+                        m_searcher.setTtPageMode(*newPageMode);
+                    } else {
+                        eprintln("Invalid page mode {}", value);
+                    }
+                } else if (name == "hashlayout") {
+                    if (const auto newLayout = parseTtLayout(value)) {
+                        m_searcher.setTtLayout(*newLayout);
+                    } else {
+                        eprintln("Invalid TT layout {}", value);
+                    }
+                } else if (name == "hashshallow") {
+                    if (!value.empty()) {
+                        if (const auto newShallowSize = util::tryParse<usize>(value)) {
+                            m_searcher.setTtShallowSize(kTtShallowSizeKibRange.clamp(*newShallowSize));
+                        }
+                    }
+                } else if (name == "hashfile") {
+                    m_searcher.setTtSnapshotFile(value == "<empty>" ? std::string{} : value);
+                } else if (name == "hashshared") {
+                    m_searcher.setTtSharedName(value == "<empty>" ? std::string{} : value);
+                } else if (name == "hashstats") {
+                    if (!value.empty()) {
+                        if (const auto newTtStats = util::tryParseBool(value)) {
+                            opts::mutableOpts().ttStats = *newTtStats;
+                        }
+                    }
                 } else if (name == "threads") {
                     if (!value.empty()) {
                         if (const auto newThreads = util::tryParse<u32>(value)) {
@@ -768,12 +906,39 @@ namespace stormphrax {
                             opts::mutableOpts().enableWeirdTcs = *newEnableWeirdTcs;
                         }
                     }
+                } else if (name == "ponder") {
+                    if (!value.empty()) {
+                        if (const auto newPonder = util::tryParseBool(value)) {
+                            opts::mutableOpts().ponder = *newPonder;
+                        }
+                    }
                 } else if (name == "minimal") {
                     if (!value.empty()) {
                         if (const auto newMinimal = util::tryParseBool(value)) {
                             opts::mutableOpts().minimal = *newMinimal;
                         }
                     }
+                } else if (name == "evalfile") {
+                    if (eval::loadNetworkFile(value.empty() ? "<internal>" : value)) {
+                        println("info string loaded network {}", eval::networkName());
+                    }
+                } else if (name == "evalpages") {
+                    if (const auto newPageMode = util::parsePageMode(value)) {
+                        eval::setNetworkPageMode(*newPageMode);
+                        println(
+                            "info string network backed by {} (requested {})",
+                            util::pageBackingName(eval::networkPageBacking()),
+                            util::pageModeName(*newPageMode)
+                        );
+                    } else {
+                        eprintln("Invalid page mode {}", value);
+                    }
+                } else if (name == "evalcache") {
+                    if (!value.empty()) {
+                        if (const auto newEvalCache = util::tryParseBool(value)) {
+                            opts::mutableOpts().evalCache = *newEvalCache;
+                        }
+                    }
                 } else if (name == "syzygypath") {
                     m_tbInitialized = true;
                     opts::mutableOpts().syzygyEnabled = tb::init(value) == tb::InitStatus::kSuccess;
@@ -924,34 +1089,126 @@ namespace stormphrax {
                 return;
             }
 
-            i32 depth = bench::kDefaultBenchDepth;
-            usize ttSize = bench::kDefaultBenchTtSize;
+            bool verbose = false;
+
+            if (!args.empty() && args.back() == "verbose") {
+                verbose = true;
+                args = args.first(args.size() - 1);
+            }
+
+            if (const auto benchArgs = parseBenchArgs(args)) {
+                bench::run(benchArgs->first, benchArgs->second, verbose);
+                m_quit = true;
+            }
+        }
+
+        void UciHandler::handleTtbench(std::span<const std::string_view> args) {
+            if (m_searcher.searching()) {
+                eprintln("already searching");
+                return;
+            }
+
+            if (const auto benchArgs = parseBenchArgs(args)) {
+                bench::runTt(benchArgs->first, benchArgs->second);
+            }
+        }
+
+        void UciHandler::handleEvalcachebench(std::span<const std::string_view> args) {
+            if (m_searcher.searching()) {
+                eprintln("already searching");
+                return;
+            }
+
+            if (const auto benchArgs = parseBenchArgs(args)) {
+                bench::runEvalCache(benchArgs->first, benchArgs->second);
+            }
+        }
+
+        void UciHandler::handleEvalpagesbench(std::span<const std::string_view> args) {
+            if (m_searcher.searching()) {
+                eprintln("already searching");
+                return;
+            }
+
+            if (const auto benchArgs = parseBenchArgs(args)) {
+                bench::runEvalPages(benchArgs->first, benchArgs->second);
+            }
+        }
+
+        void UciHandler::handleLatencybench(std::span<const std::string_view> args) {
+            if (m_searcher.searching()) {
+                eprintln("already searching");
+                return;
+            }
+
+            u32 maxThreads = 0;
 
             if (args.size() > 0) {
-                if (const auto newDepth = util::tryParse<u32>(args[0])) {
-                    depth = static_cast<i32>(*newDepth);
+                if (const auto newMaxThreads = util::tryParse<u32>(args[0])) {
+                    maxThreads = opts::kThreadCountRange.clamp(*newMaxThreads);
                 } else {
-                    eprintln("invalid depth {}", args[0]);
+                    eprintln("invalid thread count {}", args[0]);
                     return;
                 }
             }
 
-            if (args.size() > 1) {
-                if (const auto newTtSize = util::tryParse<usize>(args[2])) {
-                    ttSize = static_cast<i32>(*newTtSize);
-                } else {
-                    eprintln("invalid tt size {}", args[2]);
+            bench::runLatency(maxThreads);
+        }
+
+        void UciHandler::handleScalingbench(std::span<const std::string_view> args) {
+            if (m_searcher.searching()) {
+                eprintln("already searching");
+                return;
+            }
+
+            bench::ScalingBenchConfig config{};
+
+            for (usize i = 0; i < args.size(); ++i) {
+                const auto arg = args[i];
+
+                if (arg == "csv" || arg == "json") {
+                    config.json = arg == "json";
+                    continue;
+                }
+
+                if (arg != "threads" && arg != "movetime" && arg != "nodes" && arg != "hash") {
+                    eprintln("Unknown scalingbench argument '{}'", arg);
                     return;
                 }
-            }
 
-            if (depth == 0) {
-                depth = 1;
+                if (++i == args.size()) {
+                    eprintln("Missing {}", arg);
+                    return;
+                }
+
+                const auto value = util::tryParse<usize>(args[i]);
+
+                if (!value) {
+                    eprintln("Invalid {} '{}'", arg, args[i]);
+                    return;
+                }
+
+                if (arg == "threads") {
+                    config.maxThreads = opts::kThreadCountRange.clamp(static_cast<u32>(*value));
+                } else if (arg == "movetime") {
+                    config.moveTimeMs = std::max<u32>(static_cast<u32>(*value), 1);
+                } else if (arg == "nodes") {
+                    config.nodes = *value;
+                } else {
+                    config.ttSize = kTtSizeMibRange.clamp(*value);
+                }
             }
 
-            bench::run(depth, ttSize);
+            bench::runScaling(config);
+        }
+
+        void UciHandler::handleEvalbench() {
+            if (m_searcher.searching()) {
+                eprintln("already searching");
+                return;
+            }
 
-            m_quit = true;
+            eval::evalbench::run();
         }
 
         void UciHandler::handleProbeWdl() {
@@ -1007,6 +1264,69 @@ namespace stormphrax {
             m_keyHistory.push_back(m_pos.key());
             m_pos = m_pos.applyMove(move);
         }
+
+        void UciHandler::handleSavehash(std::span<const std::string_view> args) {
+            if (m_searcher.searching()) {
+                eprintln("still searching");
+                return;
+            }
+
+            if (args.empty()) {
+                eprintln("Missing path");
+                return;
+            }
+
+            const auto path = joinArgs(args);
+            m_searcher.saveTtSnapshot(path);
+        }
+
+        void UciHandler::handleLoadhash(std::span<const std::string_view> args) {
+            if (m_searcher.searching()) {
+                eprintln("still searching");
+                return;
+            }
+
+            if (args.empty()) {
+                eprintln("Missing path");
+                return;
+            }
+
+            const auto path = joinArgs(args);
+            m_searcher.loadTtSnapshot(path);
+        }
+
+        void UciHandler::handleTtstats(std::span<const std::string_view> args) {
+            if (m_searcher.searching()) {
+                eprintln("still searching");
+                return;
+            }
+
+            if (!args.empty()) {
+                if (args[0] == "reset") {
+                    m_searcher.resetTtStats();
+                } else {
+                    eprintln("invalid ttstats argument {}", args[0]);
+                }
+
+                return;
+            }
+
+            const auto [entries, filled, current] = m_searcher.ttOccupancy();
+
+            const auto percent = [&](usize n) {
+                return static_cast<f64>(n) * 100.0 / static_cast<f64>(entries);
+            };
+
+            println("TT entries: {}", entries);
+            println("    filled: {} ({:.2f}%)", filled, percent(filled));
+            println("    current search: {} ({:.2f}%)", current, percent(current));
+
+            if (const auto stats = m_searcher.ttStats()) {
+                stats->print();
+            } else {
+                println("Enable HashStats to collect probe and write counters");
+            }
+        }
     } // namespace
 
 #if SP_EXTERNAL_TUNE
@@ -22,12 +22,34 @@
 
 #include <atomic>
 #include <cassert>
-#include <condition_variable>
-#include <mutex>
+#include <thread>
+
+#if defined(__x86_64__) || defined(_M_X64)
+    #include <immintrin.h>
+#endif
+
+#include "../arch.h"
 
 namespace stormphrax::util {
+    inline void spinPause() {
+#if defined(__x86_64__) || defined(_M_X64)
+        _mm_pause();
+#elif defined(__aarch64__)
+        __asm__ __volatile__("yield");
+#endif
+    }
+
+    // Waiters spin on the phase for a short while before sleeping on it with atomic wait
+    // (a futex on Linux), so that threads released within microseconds of arriving, as
+    // they are at the start and end of a search, never go through the kernel. The last
+    // arrival only makes a syscall to wake waiters if any of them actually went to sleep.
+    // With more threads than cores, spinning would only hold up the threads yet to arrive
     class Barrier {
     public:
+        // pause takes anywhere from a few cycles to ~140 on Skylake and later, so this
+        // is anywhere from ~10 us to ~150 us or more, depending on the cpu
+        static constexpr u32 kSpinIterations = 1 << 12;
+
         explicit Barrier(i64 expected) {
             reset(expected);
         }
@@ -38,34 +60,54 @@ namespace stormphrax::util {
 
             m_total.store(expected, std::memory_order::seq_cst);
             m_current.store(expected, std::memory_order::seq_cst);
+
+            const auto cores = std::thread::hardware_concurrency();
+            m_spinIterations = cores == 0 || expected > cores ? 0 : kSpinIterations;
         }
 
         void arriveAndWait() {
-            std::unique_lock lock{m_waitMutex};
+            // read before arriving, as the barrier may be reset as soon as it opens
+            const auto spinIterations = m_spinIterations;
 
-            const auto current = --m_current;
+            // the phase cannot advance until this thread has arrived
+            const auto phase = m_phase.load(std::memory_order::acquire);
 
-            if (current > 0) {
-                const auto phase = m_phase.load(std::memory_order::relaxed);
-                m_waitSignal.wait(lock, [this, phase] {
-                    return (phase - m_phase.load(std::memory_order::acquire)) < 0;
-                });
-            } else {
-                const auto total = m_total.load(std::memory_order::acquire);
-                m_current.store(total, std::memory_order::release);
+            if (m_current.fetch_sub(1, std::memory_order::acq_rel) == 1) {
+                m_current.store(m_total.load(std::memory_order::relaxed), std::memory_order::relaxed);
+                m_phase.store(phase + 1, std::memory_order::seq_cst);
 
-                ++m_phase;
+                if (m_sleepers.load(std::memory_order::seq_cst) > 0) {
+                    m_phase.notify_all();
+                }
 
-                m_waitSignal.notify_all();
+                return;
             }
+
+            for (u32 i = 0; i < spinIterations; ++i) {
+                if (m_phase.load(std::memory_order::acquire) != phase) {
+                    return;
+                }
+
+                spinPause();
+            }
+
+            m_sleepers.fetch_add(1, std::memory_order::seq_cst);
+
+            while (m_phase.load(std::memory_order::seq_cst) == phase) {
+                m_phase.wait(phase, std::memory_order::seq_cst);
+            }
+
+            m_sleepers.fetch_sub(1, std::memory_order::relaxed);
         }
 
     private:
-        std::atomic<i64> m_total{};
+        // arrivals and waiters touch separate lines
+        alignas(kCacheLineSize) std::atomic<i64> m_total{};
         std::atomic<i64> m_current{};
-        std::atomic<i64> m_phase{};
 
-        std::mutex m_waitMutex{};
-        std::condition_variable m_waitSignal{};
+        u32 m_spinIterations{};
+
+        alignas(kCacheLineSize) std::atomic<u32> m_phase{};
+        std::atomic<u32> m_sleepers{};
     };
 } // namespace stormphrax::util
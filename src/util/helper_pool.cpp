@@ -0,0 +1,110 @@
+/*
+ * Stormphrax, a UCI chess engine
+ * Copyright (C) 2026 Ciekce
+ *
+ * Stormphrax is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Stormphrax is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Stormphrax. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "helper_pool.h"
+
+#include <cassert>
+
+namespace stormphrax::util {
+    HelperPool::~HelperPool() {
+        stop();
+    }
+
+    void HelperPool::resize(u32 threadCount) {
+        wait();
+
+        if (threadCount == m_threads.size()) {
+            return;
+        }
+
+        stop();
+
+        m_quit = false;
+
+        m_threads.reserve(threadCount);
+
+        // passed in, so that a thread that only gets going after the
+        // next dispatch() still knows to pick up that job
+        const auto generation = m_generation;
+
+        for (u32 threadIdx = 0; threadIdx < threadCount; ++threadIdx) {
+            m_threads.emplace_back([this, threadIdx, generation] { run(threadIdx, generation); });
+        }
+    }
+
+    void HelperPool::dispatch(std::function<void(u32)> job) {
+        assert(!m_threads.empty());
+
+        std::unique_lock lock{m_mutex};
+
+        m_doneSignal.wait(lock, [this] { return m_running == 0; });
+
+        m_job = std::move(job);
+        m_running = m_threads.size();
+
+        ++m_generation;
+
+        m_jobSignal.notify_all();
+    }
+
+    void HelperPool::wait() {
+        std::unique_lock lock{m_mutex};
+        m_doneSignal.wait(lock, [this] { return m_running == 0; });
+    }
+
+    void HelperPool::stop() {
+        wait();
+
+        {
+            const std::unique_lock lock{m_mutex};
+            m_quit = true;
+        }
+
+        m_jobSignal.notify_all();
+
+        for (auto& thread : m_threads) {
+            thread.join();
+        }
+
+        m_threads.clear();
+    }
+
+    void HelperPool::run(u32 threadIdx, u64 generation) {
+        while (true) {
+            std::unique_lock lock{m_mutex};
+            m_jobSignal.wait(lock, [this, generation] { return m_quit || m_generation != generation; });
+
+            if (m_quit) {
+                return;
+            }
+
+            generation = m_generation;
+
+            lock.unlock();
+
+            // not replaced until every thread has finished with it
+            m_job(threadIdx);
+
+            lock.lock();
+
+            if (--m_running == 0) {
+                m_doneSignal.notify_all();
+            }
+        }
+    }
+} // namespace stormphrax::util
@@ -0,0 +1,70 @@
+/*
+ * Stormphrax, a UCI chess engine
+ * Copyright (C) 2026 Ciekce
+ *
+ * Stormphrax is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Stormphrax is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Stormphrax. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "../types.h"
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace stormphrax::util {
+    // Small set of persistent background threads. Runs one job at a time, on every thread.
+    // The threads aren't bound to NUMA nodes. The TT they clear is interleaved across
+    // every node, so each of them writes to all nodes whichever one it runs on
+    class HelperPool {
+    public:
+        HelperPool() = default;
+        ~HelperPool();
+
+        HelperPool(const HelperPool&) = delete;
+        HelperPool& operator=(const HelperPool&) = delete;
+
+        // Waits for any running job, then recreates the threads if the count changed
+        void resize(u32 threadCount);
+
+        // Starts job(threadIdx) on every thread and returns immediately.
+        // Waits for the previous job first if it is still running
+        void dispatch(std::function<void(u32)> job);
+
+        // Blocks until the current job, if any, has finished on every thread
+        void wait();
+
+        [[nodiscard]] inline u32 size() const {
+            return m_threads.size();
+        }
+
+    private:
+        std::vector<std::thread> m_threads{};
+
+        std::mutex m_mutex{};
+        std::condition_variable m_jobSignal{};
+        std::condition_variable m_doneSignal{};
+
+        std::function<void(u32)> m_job{};
+        u64 m_generation{};
+        u32 m_running{};
+        bool m_quit{};
+
+        void stop();
+        void run(u32 threadIdx, u64 generation);
+    };
+} // namespace stormphrax::util
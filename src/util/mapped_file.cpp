@@ -0,0 +1,107 @@
+/*
+ * Stormphrax, a UCI chess engine
+ * Copyright (C) 2026 Ciekce
+ *
+ * Stormphrax is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Stormphrax is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Stormphrax. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "mapped_file.h"
+
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#else
+    #include <fstream>
+
+    #include "align.h"
+#endif
+
+namespace stormphrax::util {
+#ifndef _WIN32
+    std::optional<MappedFile> mapFile(const std::string& path) {
+        const auto fd = open(path.c_str(), O_RDONLY);
+
+        if (fd < 0) {
+            return {};
+        }
+
+        struct stat st{};
+
+        if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+            close(fd);
+            return {};
+        }
+
+        const auto size = static_cast<usize>(st.st_size);
+
+        auto* ptr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        // the mapping keeps the file open
+        close(fd);
+
+        if (ptr == MAP_FAILED) {
+            return {};
+        }
+
+        return MappedFile{static_cast<const std::byte*>(ptr), size};
+    }
+
+    void unmapFile(MappedFile& file) {
+        if (file.data) {
+            munmap(const_cast<std::byte*>(file.data), file.size);
+        }
+
+        file = MappedFile{};
+    }
+#else
+    namespace {
+        constexpr usize kFileAlignment = 4096;
+    }
+
+    std::optional<MappedFile> mapFile(const std::string& path) {
+        std::ifstream stream{path, std::ios::binary | std::ios::ate};
+
+        if (!stream) {
+            return {};
+        }
+
+        const auto size = static_cast<usize>(stream.tellg());
+
+        if (size == 0) {
+            return {};
+        }
+
+        auto* data = alignedAlloc<std::byte>(kFileAlignment, size);
+
+        stream.seekg(0);
+
+        if (!stream.read(reinterpret_cast<char*>(data), static_cast<std::streamsize>(size))) {
+            alignedFree(data);
+            return {};
+        }
+
+        return MappedFile{data, size};
+    }
+
+    void unmapFile(MappedFile& file) {
+        if (file.data) {
+            alignedFree(const_cast<std::byte*>(file.data));
+        }
+
+        file = MappedFile{};
+    }
+#endif
+} // namespace stormphrax::util
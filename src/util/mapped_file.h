@@ -0,0 +1,37 @@
+/*
+ * Stormphrax, a UCI chess engine
+ * Copyright (C) 2026 Ciekce
+ *
+ * Stormphrax is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Stormphrax is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Stormphrax. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "../types.h"
+
+#include <cstddef>
+#include <optional>
+#include <string>
+
+namespace stormphrax::util {
+    struct MappedFile {
+        const std::byte* data{};
+        usize size{};
+    };
+
+    // Maps the whole file read-only. The mapping is page-aligned. On Windows,
+    // the file is read into an aligned allocation instead
+    [[nodiscard]] std::optional<MappedFile> mapFile(const std::string& path);
+    void unmapFile(MappedFile& file);
+} // namespace stormphrax::util
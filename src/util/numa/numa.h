@@ -37,6 +37,12 @@ namespace stormphrax::numa {
 
     [[nodiscard]] i32 nodeCount();
 
+    // Spreads the pages of a not-yet-touched allocation evenly across all nodes
+    void interleave(void* ptr, usize size);
+
+    // Places the pages of a not-yet-touched allocation on the given node
+    void bindMemory(void* ptr, usize size, i32 node);
+
     template <typename T>
     class NumaUniqueAllocation {
     public:
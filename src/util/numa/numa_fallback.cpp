@@ -32,5 +32,16 @@ namespace stormphrax::numa {
     i32 nodeCount() {
         return 1;
     }
+
+    void interleave(void* ptr, usize size) {
+        SP_UNUSED(ptr);
+        SP_UNUSED(size);
+    }
+
+    void bindMemory(void* ptr, usize size, i32 node) {
+        SP_UNUSED(ptr);
+        SP_UNUSED(size);
+        SP_UNUSED(node);
+    }
 } // namespace stormphrax::numa
 #endif
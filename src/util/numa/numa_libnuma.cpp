@@ -47,6 +47,16 @@ namespace stormphrax::numa {
         return static_cast<i32>(threadMapping().size());
     }
 
+    void interleave(void* ptr, usize size) {
+        if (nodeCount() > 1) {
+            numa_interleave_memory(ptr, size, numa_all_nodes_ptr);
+        }
+    }
+
+    void bindMemory(void* ptr, usize size, i32 node) {
+        numa_tonode_memory(ptr, size, node);
+    }
+
     std::span<const cpu_set_t> threadMapping() {
         static const auto s_mapping = [] {
             const auto maxNode = numa_max_node();
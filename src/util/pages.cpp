@@ -0,0 +1,200 @@
+/*
+ * Stormphrax, a UCI chess engine
+ * Copyright (C) 2026 Ciekce
+ *
+ * Stormphrax is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Stormphrax is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Stormphrax. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "pages.h"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <fstream>
+#include <string>
+
+#ifndef _WIN32
+    #include <sys/mman.h>
+#endif
+
+#include "../arch.h"
+#include "align.h"
+#include "cemath.h"
+
+namespace stormphrax::util {
+    namespace {
+        constexpr usize kSmallPageSize = 4096;
+        constexpr usize kHugePageSize = 2 * 1024 * 1024;
+        constexpr usize kGiantPageSize = 1024 * 1024 * 1024;
+
+        constexpr auto kDefaultAlignment = std::max(kCacheLineSize, kSmallPageSize);
+
+        constexpr std::array kPageModeNames = {"THP", "Huge2M", "Huge1G", "Plain"};
+
+        [[nodiscard]] constexpr usize roundUp(usize size, usize multiple) {
+            return ceilDiv(size, multiple) * multiple;
+        }
+
+        std::optional<PageAllocation> tryAlignedAlloc(usize size, usize alignment, PageBacking backing) {
+            auto* ptr = alignedAlloc<std::byte>(alignment, roundUp(size, alignment));
+
+            if (!ptr) {
+                return {};
+            }
+
+            return PageAllocation{ptr, size, backing};
+        }
+
+#ifdef MAP_HUGETLB
+        // glibc does not expose the page size flags, only the shift
+        constexpr int kMapHuge2Mib = 21 << MAP_HUGE_SHIFT;
+        constexpr int kMapHuge1Gib = 30 << MAP_HUGE_SHIFT;
+
+        std::optional<PageAllocation> tryMapHuge(usize size, usize pageSize, int sizeFlag, PageBacking backing) {
+            const auto mappedSize = roundUp(size, pageSize);
+
+            auto* ptr = mmap(
+                nullptr,
+                mappedSize,
+                PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | sizeFlag,
+                -1,
+                0
+            );
+
+            if (ptr == MAP_FAILED) {
+                return {};
+            }
+
+            return PageAllocation{ptr, mappedSize, backing};
+        }
+#endif
+
+#ifdef MADV_HUGEPAGE
+        // madvise() still succeeds when THP is set to never, so check the mode as well
+        [[nodiscard]] bool transparentHugePagesEnabled() {
+            static const bool enabled = [] {
+                std::ifstream stream{"/sys/kernel/mm/transparent_hugepage/enabled"};
+
+                std::string modes{};
+                if (!std::getline(stream, modes)) {
+                    return false;
+                }
+
+                return modes.find("[never]") == std::string::npos;
+            }();
+
+            return enabled;
+        }
+#endif
+
+        std::optional<PageAllocation> tryTransparent(usize size) {
+#ifdef MADV_HUGEPAGE
+            // not worth it for allocations smaller than a single huge page
+            if (size < kHugePageSize || !transparentHugePagesEnabled()) {
+                return {};
+            }
+
+            auto allocation = tryAlignedAlloc(size, kHugePageSize, PageBacking::kTransparent);
+
+            // the memory is still usable without huge pages, it just can't be reported as having them
+            if (allocation && madvise(allocation->ptr, roundUp(size, kHugePageSize), MADV_HUGEPAGE) != 0) {
+                allocation->backing = PageBacking::kPlain;
+            }
+
+            return allocation;
+#else
+            SP_UNUSED(size);
+            return {};
+#endif
+        }
+    } // namespace
+
+    PageAllocation allocatePages(usize size, PageMode mode) {
+        std::optional<PageAllocation> allocation{};
+
+#ifdef MAP_HUGETLB
+        if (mode == PageMode::kHuge1Gib) {
+            allocation = tryMapHuge(size, kGiantPageSize, kMapHuge1Gib, PageBacking::kHuge1Gib);
+        }
+
+        if (!allocation && (mode == PageMode::kHuge1Gib || mode == PageMode::kHuge2Mib)) {
+            allocation = tryMapHuge(size, kHugePageSize, kMapHuge2Mib, PageBacking::kHuge2Mib);
+        }
+#endif
+
+        if (!allocation && mode != PageMode::kPlain) {
+            allocation = tryTransparent(size);
+        }
+
+        if (!allocation) {
+            allocation = tryAlignedAlloc(size, kDefaultAlignment, PageBacking::kPlain);
+        }
+
+        return allocation.value_or(PageAllocation{});
+    }
+
+    void freePages(PageAllocation& allocation) {
+        switch (allocation.backing) {
+            case PageBacking::kNone:
+                break;
+#ifndef _WIN32
+            case PageBacking::kHuge2Mib:
+            case PageBacking::kHuge1Gib:
+                munmap(allocation.ptr, allocation.size);
+                break;
+#endif
+            default:
+                alignedFree(allocation.ptr);
+                break;
+        }
+
+        allocation = PageAllocation{};
+    }
+
+    std::optional<PageMode> parsePageMode(std::string_view str) {
+        std::string lower{str};
+        std::ranges::transform(lower, lower.begin(), [](auto c) { return std::tolower(c); });
+
+        for (usize i = 0; i < kPageModeNames.size(); ++i) {
+            std::string name{kPageModeNames[i]};
+            std::ranges::transform(name, name.begin(), [](auto c) { return std::tolower(c); });
+
+            if (lower == name) {
+                return static_cast<PageMode>(i);
+            }
+        }
+
+        return {};
+    }
+
+    std::string_view pageModeName(PageMode mode) {
+        return kPageModeNames[static_cast<usize>(mode)];
+    }
+
+    std::string_view pageBackingName(PageBacking backing) {
+        switch (backing) {
+            case PageBacking::kPlain:
+                return "regular pages";
+            case PageBacking::kTransparent:
+                return "transparent huge pages";
+            case PageBacking::kHuge2Mib:
+                return "2 MiB huge pages";
+            case PageBacking::kHuge1Gib:
+                return "1 GiB huge pages";
+            default:
+                return "nothing";
+        }
+    }
+} // namespace stormphrax::util
@@ -0,0 +1,60 @@
+/*
+ * Stormphrax, a UCI chess engine
+ * Copyright (C) 2026 Ciekce
+ *
+ * Stormphrax is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Stormphrax is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Stormphrax. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "../types.h"
+
+#include <optional>
+#include <string_view>
+
+namespace stormphrax::util {
+    // Requested backing for large allocations. Each mode falls back
+    // to the next weaker one (1 GiB -> 2 MiB -> THP -> plain) on failure
+    enum class PageMode : u8 {
+        kTransparent = 0,
+        kHuge2Mib,
+        kHuge1Gib,
+        kPlain,
+    };
+
+    constexpr auto kDefaultPageMode = PageMode::kTransparent;
+
+    // What an allocation actually ended up backed by
+    enum class PageBacking : u8 {
+        kNone = 0,
+        kPlain,
+        kTransparent,
+        kHuge2Mib,
+        kHuge1Gib,
+    };
+
+    struct PageAllocation {
+        void* ptr{};
+        usize size{};
+        PageBacking backing{PageBacking::kNone};
+    };
+
+    [[nodiscard]] PageAllocation allocatePages(usize size, PageMode mode);
+    void freePages(PageAllocation& allocation);
+
+    [[nodiscard]] std::optional<PageMode> parsePageMode(std::string_view str);
+
+    [[nodiscard]] std::string_view pageModeName(PageMode mode);
+    [[nodiscard]] std::string_view pageBackingName(PageBacking backing);
+} // namespace stormphrax::util
@@ -0,0 +1,259 @@
+/*
+ * Stormphrax, a UCI chess engine
+ * Copyright (C) 2026 Ciekce
+ *
+ * Stormphrax is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Stormphrax is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Stormphrax. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "shared_memory.h"
+
+#include <chrono>
+#include <string>
+#include <thread>
+
+#ifndef _WIN32
+    #include <cerrno>
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+namespace stormphrax::util {
+#ifndef _WIN32
+    namespace {
+        // The creating process sizes the object right after creating it, give it a moment
+        constexpr auto kSizeTimeout = std::chrono::seconds{1};
+
+        // An object can be removed by its last user while it is being opened, or be
+        // found abandoned by a creator that died before sizing it. Both are retried
+        constexpr u32 kMaxAttempts = 3;
+
+        [[nodiscard]] std::string objectName(std::string_view name) {
+            std::string result{};
+
+            if (!name.starts_with('/')) {
+                result += '/';
+            }
+
+            result += name;
+
+            return result;
+        }
+
+        // Open file description locks are tied to the fd rather than the process, and are
+        // converted between shared and exclusive atomically. Plain record locks are the
+        // fallback where they are not available
+        bool setLock(i32 fd, short type, bool wait) {
+            struct flock lock{};
+
+            lock.l_type = type;
+            lock.l_whence = SEEK_SET;
+
+    #ifdef F_OFD_SETLK
+            return fcntl(fd, wait ? F_OFD_SETLKW : F_OFD_SETLK, &lock) == 0;
+    #else
+            return fcntl(fd, wait ? F_SETLKW : F_SETLK, &lock) == 0;
+    #endif
+        }
+
+        [[nodiscard]] bool unlinked(i32 fd) {
+            struct stat st{};
+            return fstat(fd, &st) != 0 || st.st_nlink == 0;
+        }
+    } // namespace
+
+    std::optional<SharedMapping> mapShared(std::string_view name, usize size, std::chrono::milliseconds timeout) {
+        const auto objName = objectName(name);
+
+        for (u32 attempt = 0; attempt < kMaxAttempts; ++attempt) {
+            auto fd = shm_open(objName.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+
+            if (fd >= 0) {
+                // other processes only lock the object for a moment while it has no size yet, wait them out
+                if (!setLock(fd, F_WRLCK, true) || ftruncate(fd, static_cast<off_t>(size)) != 0) {
+                    close(fd);
+                    shm_unlink(objName.c_str());
+                    return {};
+                }
+
+                auto* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+                if (ptr == MAP_FAILED) {
+                    close(fd);
+                    shm_unlink(objName.c_str());
+                    return {};
+                }
+
+                return SharedMapping{ptr, size, true, fd};
+            }
+
+            if (errno != EEXIST) {
+                return {};
+            }
+
+            fd = shm_open(objName.c_str(), O_RDWR, 0);
+
+            if (fd < 0) {
+                if (errno == ENOENT) {
+                    continue;
+                }
+
+                return {};
+            }
+
+            const auto start = std::chrono::steady_clock::now();
+
+            bool retry = false;
+            usize existingSize{};
+
+            while (true) {
+                const auto elapsed = std::chrono::steady_clock::now() - start;
+
+                // fails while the creator is still filling the object in
+                if (setLock(fd, F_RDLCK, false)) {
+                    struct stat st{};
+
+                    if (fstat(fd, &st) != 0) {
+                        close(fd);
+                        return {};
+                    }
+
+                    // removed by its last user after we opened it
+                    if (st.st_nlink == 0) {
+                        retry = true;
+                        break;
+                    }
+
+                    if (st.st_size != 0) {
+                        existingSize = static_cast<usize>(st.st_size);
+                        break;
+                    }
+
+                    // The creator locks the object before sizing it, so it either has
+                    // not got that far yet or died before doing so. Remove it in the latter case
+                    if (elapsed >= kSizeTimeout) {
+                        if (setLock(fd, F_WRLCK, false) && !unlinked(fd)) {
+                            shm_unlink(objName.c_str());
+                        }
+
+                        retry = true;
+                        break;
+                    }
+
+                    setLock(fd, F_UNLCK, false);
+                } else if (elapsed >= timeout) {
+                    break;
+                }
+
+                std::this_thread::sleep_for(std::chrono::milliseconds{1});
+            }
+
+            if (retry) {
+                close(fd);
+                continue;
+            }
+
+            if (existingSize == 0) {
+                close(fd);
+                return {};
+            }
+
+            auto* ptr = mmap(nullptr, existingSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+            if (ptr == MAP_FAILED) {
+                close(fd);
+                return {};
+            }
+
+            return SharedMapping{ptr, existingSize, false, fd};
+        }
+
+        return {};
+    }
+
+    void publishShared(SharedMapping& mapping) {
+        // downgrades the creator's exclusive lock
+        setLock(mapping.fd, F_RDLCK, false);
+    }
+
+    void protectShared(const SharedMapping& mapping) {
+        mprotect(mapping.ptr, mapping.size, PROT_READ);
+    }
+
+    bool sharedWithOthers(const SharedMapping& mapping) {
+        if (!setLock(mapping.fd, F_WRLCK, false)) {
+            return true;
+        }
+
+        setLock(mapping.fd, F_RDLCK, false);
+        return false;
+    }
+
+    void releaseShared(SharedMapping& mapping, std::string_view name) {
+        if (mapping.fd >= 0) {
+            setLock(mapping.fd, F_UNLCK, false);
+
+            // Of several processes releasing the object at once, the last one to get here gets the
+            // lock. Nobody else can remove the object while it is held, so if it is still linked
+            // the name refers to this object and not to a newer one
+            if (setLock(mapping.fd, F_WRLCK, false) && !unlinked(mapping.fd)) {
+                shm_unlink(objectName(name).c_str());
+            }
+        }
+
+        unmapShared(mapping);
+    }
+
+    void unmapShared(SharedMapping& mapping) {
+        if (mapping.ptr) {
+            munmap(mapping.ptr, mapping.size);
+        }
+
+        // also drops the lock
+        if (mapping.fd >= 0) {
+            close(mapping.fd);
+        }
+
+        mapping = SharedMapping{};
+    }
+#else
+    std::optional<SharedMapping> mapShared(std::string_view name, usize size, std::chrono::milliseconds timeout) {
+        SP_UNUSED(name, size, timeout);
+        return {};
+    }
+
+    void publishShared(SharedMapping& mapping) {
+        SP_UNUSED(mapping);
+    }
+
+    void protectShared(const SharedMapping& mapping) {
+        SP_UNUSED(mapping);
+    }
+
+    bool sharedWithOthers(const SharedMapping& mapping) {
+        SP_UNUSED(mapping);
+        return false;
+    }
+
+    void releaseShared(SharedMapping& mapping, std::string_view name) {
+        SP_UNUSED(name);
+        unmapShared(mapping);
+    }
+
+    void unmapShared(SharedMapping& mapping) {
+        mapping = SharedMapping{};
+    }
+#endif
+} // namespace stormphrax::util
@@ -0,0 +1,66 @@
+/*
+ * Stormphrax, a UCI chess engine
+ * Copyright (C) 2026 Ciekce
+ *
+ * Stormphrax is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Stormphrax is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Stormphrax. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "../types.h"
+
+#include <chrono>
+#include <optional>
+#include <string_view>
+
+namespace stormphrax::util {
+    struct SharedMapping {
+        void* ptr{};
+        usize size{};
+        // Whether this process created the object. Freshly created objects are zero-filled
+        bool created{};
+        // Kept open for as long as the object is mapped, the lock held on it marks the object as in use
+        i32 fd{-1};
+    };
+
+    // Maps the named POSIX shared memory object read-write, creating it with
+    // the given size if it does not exist yet. The creating process holds an
+    // exclusive lock on the object until it calls publishShared(), other processes
+    // wait up to timeout for that before giving up. Every mapping holds a shared
+    // lock afterwards, which the kernel drops if the process dies. An existing
+    // object is mapped at whatever size it already has, so callers must check
+    // the size themselves. If the creator died before publishing the object,
+    // it is mapped as it was left. Always fails on Windows
+    [[nodiscard]] std::optional<SharedMapping> mapShared(
+        std::string_view name,
+        usize size,
+        std::chrono::milliseconds timeout
+    );
+
+    // Lets other processes map an object this process created
+    void publishShared(SharedMapping& mapping);
+
+    // Makes this process's mapping of the object read-only
+    void protectShared(const SharedMapping& mapping);
+
+    // Whether any other process currently has the object mapped
+    [[nodiscard]] bool sharedWithOthers(const SharedMapping& mapping);
+
+    // Unmaps the object, and removes its name if no other process has it mapped.
+    // The memory itself is freed once the last mapping is gone
+    void releaseShared(SharedMapping& mapping, std::string_view name);
+
+    // Unmaps the object without ever removing its name
+    void unmapShared(SharedMapping& mapping);
+} // namespace stormphrax::util
@@ -201,6 +201,14 @@ namespace stormphrax::util::simd {
         return impl::loadI32(ptr);
     }
 
+    // Loads a full vector's worth of T's promoted type, sign-extended from T
+    template <typename T>
+    SP_ALWAYS_INLINE_NDEBUG inline auto loadPromote(const void* ptr) = delete;
+    template <>
+    SP_ALWAYS_INLINE_NDEBUG inline auto loadPromote<i8>(const void* ptr) {
+        return impl::loadPromoteI8(ptr);
+    }
+
     template <typename T>
     SP_ALWAYS_INLINE_NDEBUG inline auto store(void* ptr, Vector<T> v) = delete;
     template <>
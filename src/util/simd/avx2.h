@@ -37,6 +37,9 @@ namespace stormphrax::util::simd {
 
     constexpr std::uintptr_t kAlignment = sizeof(__m256i);
 
+    // architectural vector registers
+    constexpr usize kRegisterCount = 16;
+
     constexpr bool kPackNonSequential = true;
 
     constexpr usize kPackGrouping = 8;
@@ -95,6 +98,12 @@ namespace stormphrax::util::simd {
             _mm256_store_si256(static_cast<VectorI8*>(ptr), v);
         }
 
+        // loads half a vector of i8, sign-extended to i16
+        SP_ALWAYS_INLINE_NDEBUG inline VectorI16 loadPromoteI8(const void* ptr) {
+            assert(isAligned<kAlignment / 2>(ptr));
+            return _mm256_cvtepi8_epi16(_mm_load_si128(static_cast<const __m128i*>(ptr)));
+        }
+
         SP_ALWAYS_INLINE_NDEBUG inline VectorI8 minI8(VectorI8 a, VectorI8 b) {
             return _mm256_min_epi8(a, b);
         }
@@ -37,6 +37,9 @@ namespace stormphrax::util::simd {
 
     constexpr std::uintptr_t kAlignment = sizeof(__m512i);
 
+    // architectural vector registers
+    constexpr usize kRegisterCount = 32;
+
     constexpr bool kPackNonSequential = true;
 
     constexpr usize kPackGrouping = 8;
@@ -95,6 +98,12 @@ namespace stormphrax::util::simd {
             _mm512_store_si512(ptr, v);
         }
 
+        // loads half a vector of i8, sign-extended to i16
+        SP_ALWAYS_INLINE_NDEBUG inline VectorI16 loadPromoteI8(const void* ptr) {
+            assert(isAligned<kAlignment / 2>(ptr));
+            return _mm512_cvtepi8_epi16(_mm256_load_si256(static_cast<const __m256i*>(ptr)));
+        }
+
         SP_ALWAYS_INLINE_NDEBUG inline VectorI8 minI8(VectorI8 a, VectorI8 b) {
             return _mm512_min_epi8(a, b);
         }
@@ -37,6 +37,9 @@ namespace stormphrax::util::simd {
 
     constexpr std::uintptr_t kAlignment = sizeof(int16x8_t);
 
+    // architectural vector registers
+    constexpr usize kRegisterCount = 32;
+
     constexpr bool kPackNonSequential = false;
 
     constexpr usize kPackGrouping = 1;
@@ -95,6 +98,12 @@ namespace stormphrax::util::simd {
             vst1q_s8(static_cast<i8*>(ptr), v);
         }
 
+        // loads half a vector of i8, sign-extended to i16
+        SP_ALWAYS_INLINE_NDEBUG inline VectorI16 loadPromoteI8(const void* ptr) {
+            assert(isAligned<kAlignment / 2>(ptr));
+            return vmovl_s8(vld1_s8(static_cast<const i8*>(ptr)));
+        }
+
         SP_ALWAYS_INLINE_NDEBUG inline VectorI8 minI8(VectorI8 a, VectorI8 b) {
             return vminq_s8(a, b);
         }